@@ -0,0 +1,93 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Types whose destructor an arena may skip. Types with a trivial
+// destructor qualify by default; classes with an empty virtual destructor
+// can opt in with a specialization.
+template <typename U>
+struct ArenaTrivial : std::is_trivially_destructible<U> {};
+
+// Monotonic memory for things that die together. Allocation bumps a
+// pointer through blocks that double in size, so objects made one after
+// another lie one after another in memory. Nothing is freed on its own:
+// clear() or the destructor runs the destructors that are needed (see
+// ArenaTrivial), newest first, and then releases every block at once.
+class Arena
+{
+public:
+    explicit Arena(size_t first_block = 64 * 1024) : m_block_size(first_block) {}
+    Arena(const Arena&) = delete;
+    Arena& operator = (const Arena&) = delete;
+    ~Arena() { clear(); }
+
+    void* allocate(size_t size, size_t align = alignof(std::max_align_t))
+    {
+        auto p = (reinterpret_cast<uintptr_t>(m_next) + align - 1) & ~uintptr_t(align - 1);
+        if (!m_next || p + size > reinterpret_cast<uintptr_t>(m_end))
+        {
+            size_t block = std::max(m_block_size, size + align);
+            m_block_size = std::min(2 * m_block_size, max_block);
+            m_blocks.push_back(new char[block]);
+            m_next = m_blocks.back();
+            m_end  = m_next + block;
+            m_capacity += block;
+            p = (reinterpret_cast<uintptr_t>(m_next) + align - 1) & ~uintptr_t(align - 1);
+        }
+        m_next = reinterpret_cast<char*>(p + size);
+        m_used += size;
+        return reinterpret_cast<void*>(p);
+    }
+
+    template <typename U, typename... Args>
+    U* make(Args&&... args)
+    {
+        U* u = new (allocate(sizeof(U), alignof(U))) U(std::forward<Args>(args)...);
+        if (!ArenaTrivial<U>::value)
+            m_finalizers = new (allocate(sizeof(Finalizer), alignof(Finalizer)))
+                               Finalizer{ &destroy<U>, u, m_finalizers };
+        return u;
+    }
+
+    void clear()
+    {
+        for (auto f = m_finalizers; f; f = f->next)
+            f->destroy(f->object);
+        m_finalizers = NULL;
+        for (auto b: m_blocks)
+            delete[] b;
+        m_blocks.clear();
+        m_next = m_end = NULL;
+        m_used = m_capacity = 0;
+    }
+
+    size_t used()     const { return m_used; }       // bytes handed out
+    size_t capacity() const { return m_capacity; }   // bytes in blocks
+    size_t blocks()   const { return m_blocks.size(); }
+
+private:
+    static const size_t max_block = 16 * 1024 * 1024;
+
+    struct Finalizer
+    {
+        void      (*destroy)(void*);
+        void*       object;
+        Finalizer*  next;
+    };
+    template <typename U>
+    static void destroy(void* u) { static_cast<U*>(u)->~U(); }
+
+    std::vector<char*> m_blocks;
+    char*              m_next = NULL;
+    char*              m_end  = NULL;
+    size_t             m_block_size;
+    size_t             m_used = 0;
+    size_t             m_capacity = 0;
+    Finalizer*         m_finalizers = NULL;
+};
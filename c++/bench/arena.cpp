@@ -0,0 +1,100 @@
+// Scene setup and teardown. n spheres are made once the way scenes used to
+// hold them, each with new in a std::list and deleted one by one, and once
+// in a Scene's arena; the report gives the time to make them, to build the
+// scene over them and to tear everything down.
+#include "../scenes.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <list>
+
+typedef std::chrono::steady_clock Clock;
+
+static double ms_since(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+struct Times
+{
+    double make, build, teardown;
+};
+
+// the spheres of random_spheres() with the same seed, without a scene
+template <typename Add>
+static void spheres(unsigned n, Add add)
+{
+    auto& m = Materials<float>::get();
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> x(-20, 20), y(-1, 10), z(-80, -15);
+    float r = 6.0f / std::cbrt(float(n));
+    for (unsigned i = 0; i < n; ++i)
+        add({x(rng), y(rng), z(rng)}, r, i % 10 ? static_cast<const Material<float>&>(m.shiny) : m.glass);
+}
+
+static Times heap(unsigned n)
+{
+    Times t;
+    auto start = Clock::now();
+    auto list = new std::list<Object<float>*>;
+    spheres(n, [&] (const Vec3<float>& c, float r, const Material<float>& m) {
+        list->push_back(new Sphere<float>(c, r, m));
+    });
+    t.make = ms_since(start);
+
+    start = Clock::now();
+    std::vector<const Object<float>*> flat(list->begin(), list->end());
+    std::vector<AABB<float>> boxes;
+    for (auto o: flat)
+        boxes.push_back(o->bounds());
+    BVH<float> bvh;
+    bvh.build(boxes);
+    PrimitiveTable<float> prims;
+    prims.build(flat, SphereArray<float>(), bvh.order());
+    t.build = ms_since(start);
+
+    start = Clock::now();
+    for (auto o: *list)
+        delete o;
+    delete list;
+    t.teardown = ms_since(start);
+    return t;
+}
+
+static Times arena(unsigned n)
+{
+    Times t;
+    auto start = Clock::now();
+    auto scene = new Scene<float>;
+    spheres(n, [&] (const Vec3<float>& c, float r, const Material<float>& m) {
+        scene->add(Sphere<float>(c, r, m));
+    });
+    t.make = ms_since(start);
+
+    start = Clock::now();
+    scene->build();
+    t.build = ms_since(start);
+
+    start = Clock::now();
+    delete scene;
+    t.teardown = ms_since(start);
+    return t;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+    {
+        printf("usage: %s\n", argv[0]);
+        return 1;
+    }
+    printf("%10s %-6s %10s %10s %12s\n", "spheres", "memory", "make ms", "build ms", "teardown ms");
+    for (unsigned n: { 10000u, 100000u, 1000000u, 4000000u })
+    {
+        Times h = heap(n), a = arena(n);
+        printf("%10u %-6s %10.1f %10.1f %12.1f\n", n, "heap", h.make, h.build, h.teardown);
+        printf("%10u %-6s %10.1f %10.1f %12.1f\n", n, "arena", a.make, a.build, a.teardown);
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,157 @@
+// Rays/sec of BVH closest-hit and any-hit queries as the object count
+// grows, against the plain linear scan for the smaller scenes and the
+// widest ray packets the CPU supports.
+#include "../packet.h"
+#include <chrono>
+#include <random>
+#include <cstdio>
+
+const static unsigned width  = 320;
+const static unsigned height = 180;
+
+typedef std::chrono::steady_clock Clock;
+
+static double seconds_since(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// n spheres scattered in a box in front of the camera, sized so that
+// roughly the same fraction of the view is covered at every count
+static void random_spheres(Scene<float>& scene, unsigned n, const Material<float>& m)
+{
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> x(-20, 20), y(-12, 12), z(-60, -20);
+    float r = 6.0f / std::cbrt(float(n));
+    for (unsigned i = 0; i < n; ++i)
+        scene.add(Sphere<float>({x(rng), y(rng), z(rng)}, r, m));
+}
+
+static std::vector<Ray<float>> primary_rays()
+{
+    std::vector<Ray<float>> rays;
+    float h = tan(45.0f / 360 * 2 * 3.1415926536f / 2) * 2;
+    float w = h * width / height;
+    for (unsigned y = 0; y < height; ++y)
+        for (unsigned x = 0; x < width; ++x)
+        {
+            Vec3<float> direction = {(float(x) - width / 2) / width  * w,
+                                     (float(height)/2 - y) / height * h,
+                                     -1.0f };
+            direction.normalize();
+            rays.push_back(Ray<float>(Vec3<float>(0), direction));
+        }
+    return rays;
+}
+
+// closest hits for the same rays traced as 4x4, 4x2 or 2x2 packets
+template <unsigned N>
+static void packet_intersect(const Scene<float>& scene, const std::vector<Ray<float>>& rays)
+{
+    const unsigned block_w = N == 4 ? 2 : 4, block_h = N / block_w;
+    RayPacket<N> packet;
+    alignas(64) float nearest[N];
+    alignas(64) int   hit[N];
+    unsigned          part[N];
+    for (unsigned by = 0; by < height; by += block_h)
+        for (unsigned bx = 0; bx < width; bx += block_w)
+        {
+            for (unsigned k = 0; k < N; ++k)
+            {
+                auto& ray = rays[(by + k / block_w) * width + bx + k % block_w];
+                packet.ox[k] = ray.start[0];
+                packet.oy[k] = ray.start[1];
+                packet.oz[k] = ray.start[2];
+                packet.dx[k] = ray.dir[0];
+                packet.dy[k] = ray.dir[1];
+                packet.dz[k] = ray.dir[2];
+                nearest[k]   = std::numeric_limits<float>::max();
+            }
+            intersect_packet(scene, packet, nearest, hit, part);
+        }
+}
+
+static void packet_intersect(const Scene<float>& scene, const std::vector<Ray<float>>& rays, unsigned n)
+{
+    switch (n)
+    {
+    case 4:  packet_intersect<4>(scene, rays);  break;
+    case 8:  packet_intersect<8>(scene, rays);  break;
+    case 16: packet_intersect<16>(scene, rays); break;
+    }
+}
+
+static const Object<float>* linear_intersect(const Scene<float>& scene, const Ray<float>& ray, float* nearest)
+{
+    const Object<float>* obj = NULL;
+    for (auto& o: scene.objects)
+    {
+        float d = std::numeric_limits<float>::max();
+        if (o->intersect(ray, &d) && d < *nearest)
+        {
+            *nearest = d;
+            obj = o;
+        }
+    }
+    return obj;
+}
+
+int main()
+{
+    Shiny<float> shiny;
+    auto rays = primary_rays();
+
+    unsigned packet = packet_width();
+    printf("%10s %10s %8s %14s %14s %14s %14s\n", "objects", "build ms", "nodes",
+           "closest Mrays", "anyhit Mrays", "linear Mrays", "packet Mrays");
+    for (unsigned n: {5u, 50u, 500u, 5000u, 50000u, 500000u, 1000000u})
+    {
+        Scene<float> scene;
+        random_spheres(scene, n, shiny);
+
+        auto start = Clock::now();
+        scene.build();
+        double build = seconds_since(start);
+
+        start = Clock::now();
+        for (auto& ray: rays)
+        {
+            float d;
+            scene.intersect(ray, &d);
+        }
+        double closest = rays.size() / seconds_since(start) / 1e6;
+
+        start = Clock::now();
+        for (auto& ray: rays)
+            scene.bvh.occluded(scene.prims, ray);
+        double anyhit = rays.size() / seconds_since(start) / 1e6;
+
+        double linear = 0;
+        if (n <= 5000)
+        {
+            start = Clock::now();
+            for (auto& ray: rays)
+            {
+                float d = std::numeric_limits<float>::max();
+                linear_intersect(scene, ray, &d);
+            }
+            linear = rays.size() / seconds_since(start) / 1e6;
+        }
+
+        double packets = 0;
+        if (packet)
+        {
+            start = Clock::now();
+            packet_intersect(scene, rays, packet);
+            packets = rays.size() / seconds_since(start) / 1e6;
+        }
+
+        printf("%10u %10.1f %8zu %14.2f %14.2f ", n, build * 1000, scene.bvh.nodes().size(), closest, anyhit);
+        if (linear)
+            printf("%14.2f ", linear);
+        else
+            printf("%14s ", "-");
+        printf("%14.2f\n", packets);
+    }
+    return 0;
+}
@@ -0,0 +1,103 @@
+// Cost of instancing. Scenes of n tori are built once as instances of one
+// shared mesh and once as n separate meshes; the report gives the geometry
+// memory of each, their scene build time and the frame time.
+#include "../render.h"
+#include "../scenes.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+typedef std::chrono::steady_clock Clock;
+
+static double ms_since(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static size_t mesh_bytes(const MeshData<float>& mesh)
+{
+    return mesh.positions.size() * sizeof(float) + mesh.indices.size() * sizeof(uint32_t) +
+           mesh.bvh.nodes().size() * sizeof(BVH<float>::Node) + mesh.bvh.order().size() * sizeof(unsigned);
+}
+
+// the instanced scene with every instance replaced by its own mesh, moved
+// into place vertex by vertex
+static size_t copy_instances(const Scene<float>& instanced, Scene<float>& scene)
+{
+    MeshData<float> shape;
+    torus(shape, 48u, 24u, 1.f, 0.35f);
+    size_t bytes = 0;
+    for (auto o: instanced.objects)
+    {
+        auto instance = dynamic_cast<const Instance<float>*>(o);
+        if (!instance)
+        {
+            auto s = static_cast<const Sphere<float>*>(o);
+            scene.add(Sphere<float>(s->center(), s->radius(), s->material()));
+            continue;
+        }
+        auto mesh = std::make_shared<MeshData<float>>();
+        mesh->indices = shape.indices;
+        auto to_world = affine_inverse(instance->to_object());
+        for (size_t v = 0; v < shape.positions.size(); v += 3)
+        {
+            auto p = transform_point(Vec3<float>{ shape.positions[v], shape.positions[v + 1],
+                                                  shape.positions[v + 2] }, to_world);
+            mesh->positions.insert(mesh->positions.end(), { p[0], p[1], p[2] });
+        }
+        mesh->build();
+        bytes += mesh_bytes(*mesh) + sizeof(TriangleMesh<float>);
+        scene.add(TriangleMesh<float>(mesh, instance->material()));
+    }
+    for (auto l: instanced.lights)
+        scene.add(Light<float>(l->position(), l->color()));
+    return bytes;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned width = 640, height = 360;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "-w") && i + 1 < argc)
+            width = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "-h") && i + 1 < argc)
+            height = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+            threads = std::max(1, atoi(argv[++i]));
+        else
+        {
+            printf("usage: %s [-w width] [-h height] [-t threads]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    ThreadPool pool(threads);
+    Framebuffer fb(width, height);
+    printf("%ux%u, %u threads\n", width, height, threads);
+    printf("%8s %-10s %12s %10s %9s\n", "tori", "geometry", "KB", "build ms", "frame ms");
+    for (unsigned n: { 10u, 100u, 1000u, 10000u })
+    {
+        Scene<float> instanced, copied;
+        instanced_tori(instanced, n);
+        MeshData<float> shape;
+        torus(shape, 48u, 24u, 1.f, 0.35f);
+        size_t bytes[2] = { mesh_bytes(shape) + sizeof(TriangleMesh<float>) + n * sizeof(Instance<float>),
+                            copy_instances(instanced, copied) };
+
+        Scene<float>* scenes[2] = { &instanced, &copied };
+        const char*   names[2]  = { "instanced", "copied" };
+        for (int k = 0; k < 2; ++k)
+        {
+            auto start = Clock::now();
+            scenes[k]->build();
+            double build = ms_since(start);
+            start = Clock::now();
+            render(*scenes[k], fb, pool, RenderSettings());
+            printf("%8u %-10s %12.0f %10.1f %9.1f\n", n, names[k], bytes[k] / 1024.0, build, ms_since(start));
+        }
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,150 @@
+// Triangle mesh cost. A closed torus is tessellated into meshes of growing
+// size, written out as OBJ and loaded back; the report gives the OBJ load
+// time (which includes the BVH build) and the build time alone, the frame
+// time over the checker board, the ray / triangle tests per camera ray
+// that hits the mesh, and the rays cast from
+// inside the tube that escaped it, which a watertight test keeps at zero.
+#define RAY_STATS
+#include "../render.h"
+#include "../scenes.h"
+#include "../mesh.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <random>
+
+typedef std::chrono::steady_clock Clock;
+
+static double ms_since(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+const float major = 5, minor = 2;
+const Vec3<float> center = { 0, 1, -20 };
+
+// u x v quads around a torus facing the camera, as OBJ
+static bool write_torus(const char* path, unsigned u, unsigned v)
+{
+    FILE* f = fopen(path, "w");
+    if (!f)
+        return false;
+    for (unsigned i = 0; i < u; ++i)
+    {
+        float a = 2 * pi * i / u;
+        for (unsigned j = 0; j < v; ++j)
+        {
+            float b = 2 * pi * j / v;
+            float r = major + minor * std::cos(b);
+            fprintf(f, "v %.7g %.7g %.7g\n", center[0] + r * std::cos(a), center[1] + r * std::sin(a),
+                    center[2] + minor * std::sin(b));
+        }
+    }
+    for (unsigned i = 0; i < u; ++i)
+        for (unsigned j = 0; j < v; ++j)
+        {
+            unsigned a = i * v + j + 1, b = (i + 1) % u * v + j + 1;
+            unsigned c = (i + 1) % u * v + (j + 1) % v + 1, d = i * v + (j + 1) % v + 1;
+            fprintf(f, "f %u %u %u %u\n", a, b, c, d);
+        }
+    return fclose(f) == 0;
+}
+
+// triangle tests per camera ray that hits the mesh
+static double tests_per_hit(const TriangleMesh<float>& mesh, unsigned width, unsigned height)
+{
+    float h = std::tan(fov / 360 * 2 * pi / 2) * 2;
+    float w = h * width / height;
+    unsigned long long hits = 0;
+    StatsRegistry::instance().collect();
+    for (unsigned y = 0; y < height; ++y)
+        for (unsigned x = 0; x < width; ++x)
+        {
+            Vec3<float> dir = { (float(x) - width / 2) / width * w, (float(height) / 2 - y) / height * h, -1 };
+            float d;
+            hits += mesh.intersect(Ray<float>(Vec3<float>(0), dir.normalized()), &d);
+        }
+    return double(StatsRegistry::instance().collect().triangle_tests) / std::max(1ull, hits);
+}
+
+// rays from points on the core circle of the tube that miss its wall
+static unsigned leaks(const TriangleMesh<float>& mesh, unsigned n)
+{
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> angle(0, 2 * pi), cosine(-1, 1);
+    unsigned missed = 0;
+    for (unsigned i = 0; i < n; ++i)
+    {
+        float a = angle(rng), z = cosine(rng), p = angle(rng);
+        float s = std::sqrt(1 - z * z);
+        Vec3<float> start = center + Vec3<float>{ std::cos(a), std::sin(a), 0 } * major;
+        Ray<float> ray(start, { s * std::cos(p), s * std::sin(p), z });
+        float d;
+        missed += !mesh.intersect(ray, &d);
+    }
+    return missed;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned width = 640, height = 360;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "-w") && i + 1 < argc)
+            width = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "-h") && i + 1 < argc)
+            height = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+            threads = std::max(1, atoi(argv[++i]));
+        else
+        {
+            printf("usage: %s [-w width] [-h height] [-t threads]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    const char* path = "mesh-bench.obj";
+    ThreadPool pool(threads);
+    Framebuffer fb(width, height);
+    printf("%ux%u, %u threads\n", width, height, threads);
+    printf("%10s %10s %10s %9s %12s %8s\n", "triangles", "load ms", "build ms", "frame ms",
+           "tests/hit", "leaks");
+    for (unsigned u: { 32u, 100u, 320u, 1000u })
+    {
+        unsigned v = u / 2;
+        if (!write_torus(path, u, v))
+        {
+            printf("cannot write %s\n", path);
+            return 1;
+        }
+        auto start = Clock::now();
+        auto mesh = std::make_shared<MeshData<float>>();
+        bool ok = load_obj(path, *mesh);
+        double load = ms_since(start);
+        remove(path);
+        if (!ok)
+            return 1;
+        start = Clock::now();
+        mesh->build();
+        double build = ms_since(start);
+
+        Scene<float> scene;
+        auto& m = Materials<float>::get();
+        scene.add(Sphere<float>({0, -10002, -20}, 10000, m.checker_board));
+        scene.add(TriangleMesh<float>(mesh, m.shiny));
+        scene.add(Light<float>({-10, 20, 30}, {2, 2, 2}));
+        scene.build();
+
+        start = Clock::now();
+        render(scene, fb, pool, RenderSettings());
+        double frame = ms_since(start);
+
+        auto& object = *static_cast<const TriangleMesh<float>*>(scene.objects.back());
+        printf("%10zu %10.1f %10.1f %9.1f %12.1f %8u\n", mesh->triangles(), load, build, frame,
+               tests_per_hit(object, width, height), leaks(object, 100000));
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,106 @@
+// Display conversion of a frame into 32 bit pixels, the way the window is
+// updated: with pow() per channel as to_8bit() does, with the gamma table
+// one value at a time, with PostProcess on one thread, and with PostProcess
+// in bands of rows over a thread pool, also with the Reinhard tone map.
+// The frames hold random linear values in [0, 1.5]; all ways but the
+// Reinhard one must give the same pixels.
+#include "../postprocess.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <thread>
+
+typedef std::chrono::steady_clock Clock;
+
+typedef std::function<void(const Framebuffer&, std::vector<uint32_t>&)> Convert;
+
+// best of a few runs in ms
+static double best_ms(const Convert& convert, const Framebuffer& fb, std::vector<uint32_t>& out)
+{
+    double best = 1e30;
+    for (int run = 0; run < 5; ++run)
+    {
+        auto start = Clock::now();
+        convert(fb, out);
+        best = std::min(best, std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+    }
+    return best;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "-t") && i + 1 < argc)
+            threads = std::max(1, atoi(argv[++i]));
+        else
+        {
+            printf("usage: %s [-t threads]\n", argv[0]);
+            return 1;
+        }
+    }
+    ThreadPool pool(threads);
+    PostProcess post;
+    PostSettings settings;
+    settings.tonemap = TONEMAP_REINHARD;
+    PostProcess reinhard(settings);
+    const uint32_t* table = GammaTable::get();
+
+    struct Way
+    {
+        const char* name;
+        Convert     convert;
+    };
+    std::vector<Way> ways = {
+        { "pow", [] (const Framebuffer& fb, std::vector<uint32_t>& out) {
+            for (size_t i = 0; i < out.size(); ++i)
+            {
+                const float* p = &fb.pixels[3 * i];
+                out[i] = to_8bit(p[2]) | (to_8bit(p[1]) << 8) | (to_8bit(p[0]) << 16);
+            }
+        } },
+        { "table", [&] (const Framebuffer& fb, std::vector<uint32_t>& out) {
+            for (size_t i = 0; i < out.size(); ++i)
+            {
+                const float* p = &fb.pixels[3 * i];
+                out[i] = display_8bit(p[2], 1, false, table) | (display_8bit(p[1], 1, false, table) << 8) |
+                         (display_8bit(p[0], 1, false, table) << 16);
+            }
+        } },
+        { "postprocess", [&] (const Framebuffer& fb, std::vector<uint32_t>& out) {
+            post.pack(fb, out.data(), 4 * fb.width, 0, 0, fb.width, fb.height);
+        } },
+        { "bands", [&] (const Framebuffer& fb, std::vector<uint32_t>& out) {
+            post.pack(fb, out.data(), 4 * fb.width, pool);
+        } },
+        { "reinhard bands", [&] (const Framebuffer& fb, std::vector<uint32_t>& out) {
+            reinhard.pack(fb, out.data(), 4 * fb.width, pool);
+        } },
+    };
+
+    printf("%u threads for bands\n", threads);
+    printf("%-12s %-16s %10s %12s\n", "frame", "conversion", "ms", "Mpixel/s");
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> value(0, 1.5f);
+    for (auto size: { std::make_pair(1280u, 720u), std::make_pair(3840u, 2160u) })
+    {
+        Framebuffer fb(size.first, size.second);
+        for (auto& v: fb.pixels)
+            v = value(rng);
+        std::vector<uint32_t> expected(size_t(fb.width) * fb.height), out(expected.size());
+        char frame[32];
+        snprintf(frame, sizeof(frame), "%ux%u", fb.width, fb.height);
+        for (auto& way: ways)
+        {
+            double ms = best_ms(way.convert, fb, way.name == ways[0].name ? expected : out);
+            if (way.name != ways[0].name && !strstr(way.name, "reinhard") && out != expected)
+                printf("%s: pixels differ\n", way.name);
+            printf("%-12s %-16s %10.2f %12.1f\n", frame, way.name, ms, out.size() / ms / 1000);
+            fflush(stdout);
+        }
+    }
+    return 0;
+}
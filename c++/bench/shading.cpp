@@ -0,0 +1,224 @@
+// Shading cost per hit. The camera rays of each scene are intersected
+// once; their hits are then shaded over and over (surface, fresnel term,
+// diffuse color and direct light, without shadow rays) three ways: through
+// Material<T>'s virtual interface as trace() used to, through the flat
+// material table one hit at a time as both integrators do, and grouped
+// by material with one inlined kernel per group.
+#include "../render.h"
+#include "../scenes.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+
+typedef std::chrono::steady_clock Clock;
+
+struct Hit
+{
+    Ray<float> ray;
+    int        prim;
+    unsigned   part;
+    float      nearest;
+};
+
+struct Case
+{
+    const char*                         name;
+    std::function<void(Scene<float>&)>  setup;
+};
+
+// n random spheres with one of m materials each, a third of them checkered
+static void many_materials(Scene<float>& scene, unsigned n, unsigned m)
+{
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> x(-20, 20), y(-1, 10), z(-80, -15), unit(0, 1);
+    std::vector<const Material<float>*> materials;
+    for (unsigned i = 0; i < m; ++i)
+    {
+        auto s = scene.add(Surface<float>());
+        s->color        = { unit(rng), unit(rng), unit(rng) };
+        s->checker      = i % 3 == 0;
+        s->reflectivity = unit(rng) * 0.5f;
+        s->transparent  = i % 5 == 0 ? 0.7f : 0;
+        s->index        = 1.4f;
+        materials.push_back(s);
+    }
+    scene.add(Sphere<float>({0, -10002, -20}, 10000, Materials<float>::get().checker_board));
+    float r = 6.0f / std::cbrt(float(n));
+    for (unsigned i = 0; i < n; ++i)
+        scene.add(Sphere<float>({x(rng), y(rng), z(rng)}, r, *materials[i % m]));
+    scene.add(Light<float>({-10, 20, 30}, {2, 2, 2}));
+}
+
+static std::vector<Hit> camera_hits(const Scene<float>& scene, unsigned width, unsigned height)
+{
+    std::vector<Hit> hits;
+    float h = std::tan(fov / 360 * 2 * pi / 2) * 2;
+    float w = h * width / height;
+    for (unsigned y = 0; y < height; ++y)
+        for (unsigned x = 0; x < width; ++x)
+        {
+            Vec3<float> dir = { (float(x) - width / 2) / width * w, (float(height) / 2 - y) / height * h, -1 };
+            Hit hit = { Ray<float>(Vec3<float>(0), dir.normalized()), -1, 0, std::numeric_limits<float>::max() };
+            hit.prim = scene.intersect(hit.ray, &hit.nearest, &hit.part);
+            if (hit.prim >= 0)
+                hits.push_back(hit);
+        }
+    return hits;
+}
+
+// the shading of one hit given how to read its material
+template <typename Reflection, typename Transparency, typename Ior, typename Diffuse>
+static inline float shade(const Scene<float>& scene, const Hit& hit, Reflection reflection,
+                          Transparency transparency, Ior ior, Diffuse diffuse)
+{
+    auto point  = hit.ray.start + hit.ray.dir * hit.nearest;
+    auto normal = scene.prims.normal(hit.prim, point, hit.part);
+    if (normal.dot(hit.ray.dir) > 0)
+        normal = -normal;
+    float facing  = std::max(0.f, -hit.ray.dir.dot(normal));
+    float fresnel = reflection() + (1 - reflection()) * std::pow(1 - facing, 5.f);
+    auto& light   = *scene.lights.front();
+    auto  to      = (light.position() - point).normalized();
+    auto  color   = light.color() * std::max(0.f, normal.dot(to)) * diffuse(point) * (1 - reflection());
+    return color[0] + color[1] + color[2] + fresnel + transparency() * ior();
+}
+
+static double shade_virtual(const Scene<float>& scene, const std::vector<Hit>& hits)
+{
+    double sum = 0;
+    for (auto& hit: hits)
+    {
+        const Material<float>* m = scene.prims.material(hit.prim).source;
+        sum += shade(scene, hit, [&] { return m->reflection(); }, [&] { return m->transparency(); },
+                     [&] { return m->ior(); }, [&] (const Vec3<float>& p) { return m->diffuse(p); });
+    }
+    return sum;
+}
+
+static double shade_table(const Scene<float>& scene, const std::vector<Hit>& hits)
+{
+    double sum = 0;
+    for (auto& hit: hits)
+    {
+        auto& m = scene.prims.material(hit.prim);
+        sum += shade(scene, hit, [&] { return m.reflection; }, [&] { return m.transparency; },
+                     [&] { return m.ior; }, [&] (const Vec3<float>& p) { return diffuse(m, p); });
+    }
+    return sum;
+}
+
+template <int S>
+static double shade_group(const Scene<float>& scene, const std::vector<Hit>& hits,
+                         const std::vector<unsigned>& order, unsigned begin, unsigned end)
+{
+    double sum = 0;
+    for (unsigned j = begin; j < end; ++j)
+    {
+        auto& hit = hits[order[j]];
+        auto& m   = scene.prims.material(hit.prim);
+        sum += shade(scene, hit, [&] { return m.reflection; }, [&] { return m.transparency; },
+                     [&] { return m.ior; }, [&] (const Vec3<float>& p) { return Shader<float, S>::diffuse(m, p); });
+    }
+    return sum;
+}
+
+// hits [first, last) sorted by material and shaded group by group
+static double shade_batch(const Scene<float>& scene, const std::vector<Hit>& hits, unsigned first, unsigned last,
+                          std::vector<unsigned>& groups, std::vector<unsigned>& order)
+{
+    auto& materials = scene.prims.materials();
+    groups.assign(materials.size() + 1, 0);
+    order.resize(hits.size());
+    for (unsigned i = first; i < last; ++i)
+        ++groups[scene.prims.material_id(hits[i].prim) + 1];
+    groups[0] = first;
+    for (size_t m = 1; m < groups.size(); ++m)
+        groups[m] += groups[m - 1];
+    for (unsigned i = first; i < last; ++i)
+        order[groups[scene.prims.material_id(hits[i].prim)]++] = i;
+
+    double sum = 0;
+    unsigned begin = first;
+    for (size_t m = 0; m < materials.size(); begin = groups[m++])
+    {
+        if (begin == groups[m])
+            continue;
+        switch (materials[m].shading)
+        {
+        case SHADE_CONSTANT: sum += shade_group<SHADE_CONSTANT>(scene, hits, order, begin, groups[m]); break;
+        case SHADE_CHECKER:  sum += shade_group<SHADE_CHECKER>(scene, hits, order, begin, groups[m]);  break;
+        default:             sum += shade_group<SHADE_VIRTUAL>(scene, hits, order, begin, groups[m]);  break;
+        }
+    }
+    return sum;
+}
+
+// in batches the size of a 32 x 32 tile, as the wavefront integrator sees them
+static double shade_grouped(const Scene<float>& scene, const std::vector<Hit>& hits)
+{
+    std::vector<unsigned> groups, order;
+    double sum = 0;
+    for (unsigned first = 0; first < hits.size(); first += 1024)
+        sum += shade_batch(scene, hits, first, std::min<unsigned>(first + 1024, hits.size()), groups, order);
+    return sum;
+}
+
+// nanoseconds per hit, best of a few runs
+static double ns_per_hit(double (*shade)(const Scene<float>&, const std::vector<Hit>&),
+                         const Scene<float>& scene, const std::vector<Hit>& hits, double* sum)
+{
+    double best = 1e30;
+    for (int run = 0; run < 5; ++run)
+    {
+        auto start = Clock::now();
+        *sum = shade(scene, hits);
+        best = std::min(best, std::chrono::duration<double, std::nano>(Clock::now() - start).count());
+    }
+    return best / std::max<size_t>(1, hits.size());
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned width = 1280, height = 720;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "-w") && i + 1 < argc)
+            width = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "-h") && i + 1 < argc)
+            height = std::max(1, atoi(argv[++i]));
+        else
+        {
+            printf("usage: %s [-w width] [-h height]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<Case> cases = {
+        { "default",          [] (Scene<float>& s) { default_scene(s); } },
+        { "spheres-10000",    [] (Scene<float>& s) { random_spheres(s, 10000); } },
+        { "materials-64",     [] (Scene<float>& s) { many_materials(s, 10000, 64); } },
+        { "materials-1024",   [] (Scene<float>& s) { many_materials(s, 10000, 1024); } },
+    };
+
+    printf("%ux%u camera rays\n", width, height);
+    printf("%-16s %9s %10s %12s %10s %12s\n", "scene", "hits", "materials", "virtual ns", "table ns", "grouped ns");
+    for (auto& c: cases)
+    {
+        Scene<float> scene;
+        c.setup(scene);
+        scene.build();
+        auto hits = camera_hits(scene, width, height);
+
+        double sums[3];
+        double v = ns_per_hit(shade_virtual, scene, hits, &sums[0]);
+        double t = ns_per_hit(shade_table,   scene, hits, &sums[1]);
+        double g = ns_per_hit(shade_grouped, scene, hits, &sums[2]);
+        if (sums[0] != sums[1] || std::abs(sums[0] - sums[2]) > 1e-9 * std::abs(sums[0]))
+            printf("%s: shading differs\n", c.name);
+        printf("%-16s %9zu %10zu %12.1f %10.1f %12.1f\n", c.name, hits.size(), scene.prims.materials().size(),
+               v, t, g);
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,189 @@
+// Frame time benchmark over a fixed set of parametric scenes. Every scene
+// is rendered a few times to warm up and then for a number of timed
+// iterations; the report gives median / p95 frame time, primary and total
+// rays per second and wall-clock ns per ray, as a table and optionally as
+// JSON for tracking across builds and machines.
+#define RAY_STATS
+#include "../render.h"
+#include "../scenes.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <functional>
+
+typedef std::chrono::steady_clock Clock;
+
+struct Case
+{
+    const char*                         name;
+    unsigned                            max_depth;
+    std::function<void(Scene<float>&)>  setup;
+};
+
+struct Result
+{
+    const char*        name;
+    size_t             objects;
+    unsigned           max_depth;
+    double             build_ms;
+    double             median_ms;
+    double             p95_ms;
+    double             min_ms;
+    unsigned long long rays;        // per frame
+};
+
+struct Options
+{
+    unsigned       width      = 640;
+    unsigned       height     = 360;
+    unsigned       threads    = std::max(1u, std::thread::hardware_concurrency());
+    unsigned       warmup     = 1;
+    unsigned       iterations = 7;
+    const char*    json       = NULL;
+    const char*    filter     = NULL;
+    RenderSettings render;
+
+    Options(int argc, char *argv[])
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            if (!strcmp(argv[i], "-w") && i + 1 < argc)
+                width = std::max(1, atoi(argv[++i]));
+            else if (!strcmp(argv[i], "-h") && i + 1 < argc)
+                height = std::max(1, atoi(argv[++i]));
+            else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+                threads = std::max(1, atoi(argv[++i]));
+            else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+                warmup = std::max(0, atoi(argv[++i]));
+            else if (!strcmp(argv[i], "-i") && i + 1 < argc)
+                iterations = std::max(1, atoi(argv[++i]));
+            else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+                json = argv[++i];
+            else if (!strcmp(argv[i], "-f") && i + 1 < argc)
+                filter = argv[++i];
+            else if (!strcmp(argv[i], "-W"))
+                render.wavefront = true;
+            else if (!strcmp(argv[i], "-p") && i + 1 < argc)
+                render.packet = std::min(unsigned(atoi(argv[++i])), packet_width());
+            else
+            {
+                printf("usage: %s [-w width] [-h height] [-t threads] [-n warmup] [-i iterations]\n"
+                       "       [-p packet] [-W] [-f scene substring] [-j results.json|-]\n", argv[0]);
+                exit(1);
+            }
+        }
+    }
+};
+
+static double percentile(std::vector<double> v, double p)
+{
+    std::sort(v.begin(), v.end());
+    size_t rank = size_t(std::ceil(p * v.size()));
+    return v[std::min(v.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+static Result run(const Case& c, const Options& options, ThreadPool& pool)
+{
+    Scene<float> scene;
+    c.setup(scene);
+    scene.max_depth = c.max_depth;
+    auto start = Clock::now();
+    scene.build();
+    double build_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    Framebuffer fb(options.width, options.height);
+    for (unsigned i = 0; i < options.warmup; ++i)
+        render(scene, fb, pool, options.render);
+    StatsRegistry::instance().collect();
+
+    std::vector<double> times;
+    for (unsigned i = 0; i < options.iterations; ++i)
+    {
+        start = Clock::now();
+        render(scene, fb, pool, options.render);
+        times.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+    }
+    RayStats stats = StatsRegistry::instance().collect();
+
+    return { c.name, scene.objects.size(), c.max_depth, build_ms,
+             percentile(times, 0.5), percentile(times, 0.95),
+             *std::min_element(times.begin(), times.end()),
+             stats.rays() / options.iterations };
+}
+
+static void write_json(FILE* f, const Options& options, const std::vector<Result>& results)
+{
+    double primary = double(options.width) * options.height;
+    fprintf(f, "{\n");
+    fprintf(f, "  \"compiler\": \"%s\",\n", __VERSION__);
+    fprintf(f, "  \"threads\": %u,\n", options.threads);
+    fprintf(f, "  \"packet\": %u,\n", options.render.packet);
+    fprintf(f, "  \"wavefront\": %s,\n", options.render.wavefront ? "true" : "false");
+    fprintf(f, "  \"width\": %u,\n", options.width);
+    fprintf(f, "  \"height\": %u,\n", options.height);
+    fprintf(f, "  \"warmup\": %u,\n", options.warmup);
+    fprintf(f, "  \"iterations\": %u,\n", options.iterations);
+    fprintf(f, "  \"scenes\": [\n");
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        auto& r = results[i];
+        fprintf(f, "    { \"name\": \"%s\", \"objects\": %zu, \"max_depth\": %u, \"build_ms\": %.3f,\n"
+                   "      \"median_ms\": %.3f, \"p95_ms\": %.3f, \"min_ms\": %.3f, \"rays_per_frame\": %llu,\n"
+                   "      \"primary_rays_per_sec\": %.0f, \"total_rays_per_sec\": %.0f, \"ns_per_ray\": %.3f }%s\n",
+                r.name, r.objects, r.max_depth, r.build_ms, r.median_ms, r.p95_ms, r.min_ms, r.rays,
+                primary / r.median_ms * 1e3, r.rays / r.median_ms * 1e3, r.median_ms * 1e6 / r.rays,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+int main(int argc, char *argv[])
+{
+    Options options(argc, argv);
+
+    std::vector<Case> cases = {
+        { "default",         6,  [] (Scene<float>& s) { default_scene(s); } },
+        { "spheres-500",     6,  [] (Scene<float>& s) { random_spheres(s, 500); } },
+        { "spheres-5000",    6,  [] (Scene<float>& s) { random_spheres(s, 5000); } },
+        { "spheres-1000000", 6,  [] (Scene<float>& s) { random_spheres(s, 1000000); } },
+        { "tori-1000",       6,  [] (Scene<float>& s) { instanced_tori(s, 1000); } },
+        { "glass-16-depth8", 8,  [] (Scene<float>& s) { deep_glass(s, 16); } },
+        { "glass-32-depth12", 12, [] (Scene<float>& s) { deep_glass(s, 32); } },
+    };
+
+    ThreadPool pool(options.threads);
+    std::vector<Result> results;
+    double primary = double(options.width) * options.height;
+
+    printf("%ux%u, %u threads, packet %u%s, %u warmup + %u iterations\n", options.width, options.height,
+           options.threads, options.render.packet,
+           options.render.wavefront ? ", wavefront" : "", options.warmup, options.iterations);
+    printf("%-18s %9s %9s %9s %9s %12s %12s %8s\n", "scene", "objects", "build ms", "median ms",
+           "p95 ms", "primary M/s", "total M/s", "ns/ray");
+    for (auto& c: cases)
+    {
+        if (options.filter && !strstr(c.name, options.filter))
+            continue;
+        Result r = run(c, options, pool);
+        printf("%-18s %9zu %9.1f %9.2f %9.2f %12.2f %12.2f %8.1f\n", r.name, r.objects, r.build_ms,
+               r.median_ms, r.p95_ms, primary / r.median_ms / 1e3, r.rays / r.median_ms / 1e3,
+               r.median_ms * 1e6 / r.rays);
+        fflush(stdout);
+        results.push_back(r);
+    }
+
+    if (options.json)
+    {
+        FILE* f = strcmp(options.json, "-") ? fopen(options.json, "w") : stdout;
+        if (!f)
+        {
+            printf("cannot write %s\n", options.json);
+            return 1;
+        }
+        write_json(f, options, results);
+        if (f != stdout)
+            fclose(f);
+    }
+    return 0;
+}
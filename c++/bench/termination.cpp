@@ -0,0 +1,98 @@
+// Cost and error of contribution-based ray termination. Each scene is
+// rendered once exactly and then with a range of min_weight thresholds,
+// with and without russian roulette; the report gives the rays saved, the
+// frame time and the error against the exact image in 8 bit display
+// units (RMS, largest, and share of pixels that changed).
+#define RAY_STATS
+#include "../render.h"
+#include "../scenes.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <functional>
+
+typedef std::chrono::steady_clock Clock;
+
+struct Case
+{
+    const char*                         name;
+    unsigned                            max_depth;
+    std::function<void(Scene<float>&)>  setup;
+};
+
+struct Frame
+{
+    unsigned long long rays;
+    double             ms;
+};
+
+static Frame render_frame(const Scene<float>& scene, Framebuffer& fb, ThreadPool& pool)
+{
+    StatsRegistry::instance().collect();
+    auto start = Clock::now();
+    render(scene, fb, pool, RenderSettings());
+    double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    return { StatsRegistry::instance().collect().rays(), ms };
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned width = 640, height = 360;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "-w") && i + 1 < argc)
+            width = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "-h") && i + 1 < argc)
+            height = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+            threads = std::max(1, atoi(argv[++i]));
+        else
+        {
+            printf("usage: %s [-w width] [-h height] [-t threads]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<Case> cases = {
+        { "default",         6,  [] (Scene<float>& s) { default_scene(s); } },
+        { "spheres-500",     6,  [] (Scene<float>& s) { random_spheres(s, 500); } },
+        { "glass-16-depth8", 8,  [] (Scene<float>& s) { deep_glass(s, 16); } },
+    };
+    const float thresholds[] = { 0.001f, 0.01f, 0.05f, 0.1f };
+
+    ThreadPool pool(threads);
+    printf("%ux%u, %u threads\n", width, height, threads);
+    printf("%-18s %-9s %10s %9s %8s %9s %9s %9s\n", "scene", "cutoff", "rays", "saved %",
+           "ms", "rms", "max", "changed %");
+    for (auto& c: cases)
+    {
+        Scene<float> scene;
+        c.setup(scene);
+        scene.max_depth = c.max_depth;
+        scene.build();
+
+        Framebuffer exact(width, height), fb(width, height);
+        Frame base = render_frame(scene, exact, pool);
+        printf("%-18s %-9s %10llu %9s %8.1f\n", c.name, "none", base.rays, "", base.ms);
+
+        for (int roulette = 0; roulette < 2; ++roulette)
+        {
+            for (float t: thresholds)
+            {
+                scene.min_weight = t;
+                scene.roulette   = roulette;
+                Frame f = render_frame(scene, fb, pool);
+
+                auto d = difference(fb, exact);
+                char name[32];
+                snprintf(name, sizeof(name), "%s%g", roulette ? "rr " : "", t);
+                printf("%-18s %-9s %10llu %9.1f %8.1f %9.3f %9d %9.2f\n", "", name, f.rays,
+                       100.0 * (1 - double(f.rays) / base.rays), f.ms, d.rms, d.max, 100 * d.changed);
+            }
+        }
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,78 @@
+// Texture tile cache. The test pattern is written out as a texture file
+// and the textured scene is rendered with a range of cache sizes, each
+// starting cold; the report gives the frame time, the cache lookups that
+// got past the per-thread tiles, their hit rate, the data read from disk
+// and what the cache held at the end, against the size of the whole
+// texture with its mip levels.
+#include "../render.h"
+#include "../scenes.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+typedef std::chrono::steady_clock Clock;
+
+int main(int argc, char *argv[])
+{
+    unsigned width = 1280, height = 720, size = 4096;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "-w") && i + 1 < argc)
+            width = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "-h") && i + 1 < argc)
+            height = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+            threads = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+            size = std::max(1, atoi(argv[++i]));
+        else
+        {
+            printf("usage: %s [-w width] [-h height] [-t threads] [-s texture_size]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    const char* path = "texture-bench.tex";
+    {
+        std::vector<unsigned char> rgb;
+        texture_pattern(size, rgb);
+        if (!write_texture(path, rgb.data(), size, size))
+        {
+            printf("cannot write %s\n", path);
+            return 1;
+        }
+    }
+    auto texture = std::make_shared<Texture>();
+    bool ok = texture->open(path);
+    remove(path);
+    if (!ok)
+        return 1;
+    size_t whole = 0;
+    for (unsigned l = 0; l < texture->levels(); ++l)
+        whole += size_t(texture->tiles_x(l)) * texture->tiles_y(l) * texture_page;
+
+    Scene<float> scene;
+    textured_scene(scene, std::shared_ptr<const Texture>(texture), std::tan(fov / 360 * pi) * 2 / height);
+    scene.build();
+    ThreadPool pool(threads);
+    Framebuffer fb(width, height);
+
+    printf("%ux%u, %u threads, %ux%u texture, %zu MB with mip levels\n", width, height, threads, size, size,
+           whole >> 20);
+    printf("%9s %9s %10s %8s %10s %12s\n", "cache MB", "frame ms", "lookups", "hit %", "read MB", "resident MB");
+    auto& cache = TileCache::instance();
+    for (unsigned mb: { 1u, 4u, 16u, 64u, 256u })
+    {
+        cache.clear();
+        cache.set_capacity(size_t(mb) << 20);
+        auto start = Clock::now();
+        render(scene, fb, pool, RenderSettings());
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        auto s = cache.stats();
+        printf("%9u %9.1f %10llu %8.1f %10.1f %12.1f\n", mb, ms, s.lookups, 100 * s.hit_rate(),
+               s.bytes_read / 1048576.0, s.resident / 1048576.0);
+        fflush(stdout);
+    }
+    return 0;
+}
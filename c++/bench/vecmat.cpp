@@ -0,0 +1,82 @@
+// Vec<float, 3>, Vec<float, 4> and Vec<double, 3> against the generic
+// element-wise template, on the operations trace() leans on.
+#include "../vecmat.h"
+#include <chrono>
+#include <random>
+#include <vector>
+#include <cstdio>
+
+template <typename T, std::size_t N>
+struct Generic : VecBase<Generic<T, N>, T, N>
+{
+    using VecBase<Generic<T, N>, T, N>::VecBase;
+    Generic() {}
+};
+
+typedef std::chrono::steady_clock Clock;
+
+static const unsigned count  = 4096;
+static const unsigned rounds = 2000;
+
+template <typename V>
+static std::vector<V> random_vectors()
+{
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> u(-10, 10);
+    std::vector<V> v(count);
+    for (auto& x: v)
+        for (auto& e: x)
+            e = u(rng);
+    return v;
+}
+
+// ns per operation for op(a[i], b[i]), folded into a checksum so the work
+// cannot be optimized away
+template <typename V, typename OP>
+static double measure(OP op, double* checksum)
+{
+    auto a = random_vectors<V>(), b = random_vectors<V>();
+    typename V::value_type sum = 0;
+    auto start = Clock::now();
+    for (unsigned r = 0; r < rounds; ++r)
+        for (unsigned i = 0; i < count; ++i)
+            sum += op(a[i], b[i]);
+    double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    *checksum += sum;
+    return ns / (double(rounds) * count);
+}
+
+template <typename V>
+static void run(const char* name, double* checksum)
+{
+    typedef typename V::value_type T;
+    double add  = measure<V>([] (const V& a, const V& b) { return (a + b)[0]; }, checksum);
+    double mad  = measure<V>([] (const V& a, const V& b) { return (a * T(2) + b * a - b)[1]; }, checksum);
+    double dot  = measure<V>([] (const V& a, const V& b) { return a.dot(b); }, checksum);
+    double norm = measure<V>([] (const V& a, const V&) { return a.normalized()[2]; }, checksum);
+    double fast = measure<V>([] (const V& a, const V&) { V t(a); t.normalize_fast(); return t[2]; }, checksum);
+    double refl = measure<V>([] (const V& a, const V& b) {
+            auto n = b.normalized();
+            return (a + n * 2 * a.dot(n) * T(-1)).dot(n); }, checksum);
+    printf("%-18s %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f\n", name, add, mad, dot, norm, fast, refl);
+}
+
+int main()
+{
+    double checksum = 0;
+    printf("%-18s %8s %8s %8s %8s %8s %8s   (ns/op)\n",
+           "type", "add", "mul-add", "dot", "norm", "rsqrt", "reflect");
+    run<Generic<float, 3>>("generic float3", &checksum);
+    run<Vec<float, 3>>    ("Vec<float, 3>", &checksum);
+    run<Generic<float, 4>>("generic float4", &checksum);
+    run<Vec<float, 4>>    ("Vec<float, 4>", &checksum);
+    run<Generic<double, 3>>("generic double3", &checksum);
+    run<Vec<double, 3>>   ("Vec<double, 3>", &checksum);
+#ifndef VECMAT_SIMD
+    printf("built without SIMD specializations\n");
+#elif !defined(__AVX__)
+    printf("built without AVX: Vec<double, 3> is the generic template (make AVX=1)\n");
+#endif
+    printf("checksum %g\n", checksum);
+    return 0;
+}
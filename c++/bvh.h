@@ -0,0 +1,334 @@
+#pragma once
+
+#include "objects.h"
+#include "stats.h"
+#include <vector>
+
+// Bounding volume hierarchy over scene primitives, built top-down with a
+// binned surface area heuristic. Nodes live in one flat array; an interior
+// node's children are stored next to each other. Leaves refer to
+// consecutive slots of a primitive set laid out in order(), which provides
+// intersect(slot, ray, distance, part).
+template <typename T>
+class BVH
+{
+public:
+    // nodes this deep are leaves whatever they hold, so a traversal never
+    // has more than stack_size nodes pending
+    enum { max_depth = 64, stack_size = max_depth + 1 };
+
+    struct Node
+    {
+        AABB<T>  box;
+        unsigned first;         // leaf: first slot, interior: left child
+        unsigned count;         // number of primitives, 0 for interior nodes
+    };
+
+    void build(const std::vector<AABB<T>>& boxes)
+    {
+        m_nodes.clear();
+        m_order.clear();
+        m_build_area.clear();
+        if (boxes.empty())
+            return;
+
+        std::vector<Primitive> prims;
+        prims.reserve(boxes.size());
+        for (size_t i = 0; i < boxes.size(); ++i)
+            prims.push_back({boxes[i], boxes[i].center(), unsigned(i)});
+        m_nodes.reserve(2 * prims.size());
+        m_nodes.push_back(Node());
+        subdivide(prims, 0, 0, prims.size(), 0);
+
+        m_order.reserve(prims.size());
+        for (auto& p: prims)
+            m_order.push_back(p.index);
+        for (auto& node: m_nodes)
+            m_build_area.push_back(node.box.area());
+    }
+
+    // Fit the node boxes to primitives that moved; boxes is indexed like
+    // the input to build(). The tree keeps its topology, so it stays
+    // correct but gets slower as objects drift away from their original
+    // neighbours; degradation() tells when a rebuild is due.
+    void refit(const std::vector<AABB<T>>& boxes)
+    {
+        // children always come after their parent
+        for (size_t n = m_nodes.size(); n-- > 0; )
+        {
+            Node&   node = m_nodes[n];
+            AABB<T> box;
+            if (node.count)
+            {
+                for (unsigned i = node.first; i < node.first + node.count; ++i)
+                    box.extend(boxes[m_order[i]]);
+            }
+            else
+            {
+                box.extend(m_nodes[node.first].box);
+                box.extend(m_nodes[node.first + 1].box);
+            }
+            node.box = box;
+        }
+    }
+
+    // how much refitting has grown the node boxes since the tree was
+    // built, as their mean area ratio; the SAH splits stop fitting the
+    // objects as this rises
+    T degradation() const
+    {
+        if (m_nodes.empty())
+            return 1;
+        T sum = 0;
+        for (size_t i = 0; i < m_nodes.size(); ++i)
+            sum += m_build_area[i] > 0 ? m_nodes[i].box.area() / m_build_area[i] : T(1);
+        return sum / m_nodes.size();
+    }
+
+    // slot of the nearest primitive hit by the ray, or -1; part, if given,
+    // receives the part of it that was hit (see Object<T>)
+    template <typename P>
+    int intersect(const P& prims, const Ray<T>& ray, T* distance, unsigned* part = NULL) const
+    {
+        int hit = -1;
+        T nearest = std::numeric_limits<T>::max();
+        unsigned hit_part = 0;
+        if (m_nodes.empty())
+            return hit;
+
+        auto inv = inverse(ray.dir);
+        unsigned stack[stack_size];
+        unsigned top = 0;
+        stack[top++] = 0;
+        while (top)
+        {
+            const Node& node = m_nodes[stack[--top]];
+            if (node.count)
+            {
+                for (unsigned i = node.first; i < node.first + node.count; ++i)
+                {
+                    T d = std::numeric_limits<T>::max();
+                    unsigned p = 0;
+                    if (prims.intersect(i, ray, &d, &p) && d < nearest)
+                    {
+                        nearest = d;
+                        hit = i;
+                        hit_part = p;
+                    }
+                }
+                continue;
+            }
+            // visit the nearer child first
+            T t0, t1;
+            bool hit0 = slab(m_nodes[node.first].box,     ray, inv, nearest, &t0);
+            bool hit1 = slab(m_nodes[node.first + 1].box, ray, inv, nearest, &t1);
+            if (hit0 && hit1)
+            {
+                stack[top++] = t0 < t1 ? node.first + 1 : node.first;
+                stack[top++] = t0 < t1 ? node.first : node.first + 1;
+            }
+            else if (hit0)
+                stack[top++] = node.first;
+            else if (hit1)
+                stack[top++] = node.first + 1;
+        }
+        if (hit >= 0)
+        {
+            *distance = nearest;
+            if (part)
+                *part = hit_part;
+        }
+        return hit;
+    }
+
+    // slot of any primitive hit by the ray closer than distance, or -1;
+    // stops at the first one found
+    template <typename P>
+    int occluder(const P& prims, const Ray<T>& ray, T distance) const
+    {
+        if (m_nodes.empty())
+            return -1;
+
+        auto inv = inverse(ray.dir);
+        unsigned stack[stack_size];
+        unsigned top = 0;
+        stack[top++] = 0;
+        while (top)
+        {
+            const Node& node = m_nodes[stack[--top]];
+            T t;
+            if (!slab(node.box, ray, inv, distance, &t))
+                continue;
+            if (node.count)
+            {
+                for (unsigned i = node.first; i < node.first + node.count; ++i)
+                {
+                    T d;
+                    STAT(shadow_tests++);
+                    if (prims.intersect(i, ray, &d) && d < distance)
+                        return i;
+                }
+            }
+            else
+            {
+                stack[top++] = node.first + 1;
+                stack[top++] = node.first;
+            }
+        }
+        return -1;
+    }
+
+    // true if any primitive intersects the ray closer than distance
+    template <typename P>
+    bool occluded(const P& prims, const Ray<T>& ray,
+                  T distance = std::numeric_limits<T>::max()) const
+    {
+        return occluder(prims, ray, distance) >= 0;
+    }
+
+    const std::vector<Node>&     nodes() const { return m_nodes; }
+    // slot i holds input primitive order()[i]
+    const std::vector<unsigned>& order() const { return m_order; }
+
+private:
+    enum { bins = 16, max_leaf = 4 };
+    // cost of visiting a node relative to one object intersection
+    static constexpr T traversal_cost = T(0.5);
+
+    struct Primitive
+    {
+        AABB<T>  box;
+        Vec3<T>  center;
+        unsigned index;
+    };
+
+    static Vec3<T> inverse(const Vec3<T>& dir)
+    {
+        return { T(1) / dir[0], T(1) / dir[1], T(1) / dir[2] };
+    }
+
+    // ray / box slab test over [0, tmax]; *tnear receives the entry distance
+    static bool slab(const AABB<T>& box, const Ray<T>& ray, const Vec3<T>& inv, T tmax, T* tnear)
+    {
+        T tmin = 0;
+        for (int i = 0; i < 3; ++i)
+        {
+            T a = (box.lo[i] - ray.start[i]) * inv[i];
+            T b = (box.hi[i] - ray.start[i]) * inv[i];
+            if (a > b)
+                std::swap(a, b);
+            tmin = std::max(tmin, a);
+            tmax = std::min(tmax, b);
+        }
+        *tnear = tmin;
+        return tmin <= tmax;
+    }
+
+    void subdivide(std::vector<Primitive>& prims, unsigned index, size_t begin, size_t end, unsigned depth)
+    {
+        AABB<T> box, centers;
+        for (size_t i = begin; i < end; ++i)
+        {
+            box.extend(prims[i].box);
+            centers.extend(prims[i].center);
+        }
+        m_nodes[index].box = box;
+
+        size_t count = end - begin;
+        if (depth == max_depth)
+        {
+            m_nodes[index].first = begin;
+            m_nodes[index].count = count;
+            return;
+        }
+        int    best_axis = -1;
+        int    best_bin  = 0;
+        T      best_cost = T(count) * box.area();
+        if (count > 1)
+        {
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                T lo = centers.lo[axis], extent = centers.hi[axis] - lo;
+                if (extent <= 0)
+                    continue;
+                AABB<T> bin_box[bins];
+                size_t  bin_count[bins] = {};
+                for (size_t i = begin; i < end; ++i)
+                {
+                    int b = bin_of(prims[i].center[axis], lo, extent);
+                    bin_box[b].extend(prims[i].box);
+                    ++bin_count[b];
+                }
+                // sweep from the right to get the cost of every split plane
+                T       right_area[bins];
+                size_t  right_count[bins];
+                AABB<T> acc;
+                size_t  n = 0;
+                for (int b = bins - 1; b > 0; --b)
+                {
+                    acc.extend(bin_box[b]);
+                    n += bin_count[b];
+                    right_area[b]  = n ? acc.area() : T(0);
+                    right_count[b] = n;
+                }
+                acc = AABB<T>();
+                n = 0;
+                for (int b = 0; b < bins - 1; ++b)
+                {
+                    acc.extend(bin_box[b]);
+                    n += bin_count[b];
+                    if (!n || !right_count[b + 1])
+                        continue;
+                    T cost = box.area() * traversal_cost
+                           + T(n) * acc.area() + T(right_count[b + 1]) * right_area[b + 1];
+                    if (cost < best_cost)
+                    {
+                        best_cost = cost;
+                        best_axis = axis;
+                        best_bin  = b;
+                    }
+                }
+            }
+        }
+
+        if (best_axis < 0 && count <= max_leaf)
+        {
+            m_nodes[index].first = begin;
+            m_nodes[index].count = count;
+            return;
+        }
+
+        size_t mid;
+        if (best_axis >= 0)
+        {
+            T lo = centers.lo[best_axis], extent = centers.hi[best_axis] - lo;
+            mid = std::partition(prims.begin() + begin, prims.begin() + end,
+                                 [&] (const Primitive& p) {
+                                     return bin_of(p.center[best_axis], lo, extent) <= best_bin;
+                                 }) - prims.begin();
+        }
+        else
+        {
+            // no useful split plane but too many objects for one leaf
+            mid = begin + count / 2;
+        }
+
+        unsigned left = m_nodes.size();
+        m_nodes[index].first = left;
+        m_nodes[index].count = 0;
+        m_nodes.push_back(Node());
+        m_nodes.push_back(Node());
+        subdivide(prims, left,     begin, mid, depth + 1);
+        subdivide(prims, left + 1, mid,   end, depth + 1);
+    }
+
+    static int bin_of(T x, T lo, T extent)
+    {
+        int b = int((x - lo) / extent * bins);
+        return std::min(std::max(b, 0), int(bins) - 1);
+    }
+
+    std::vector<Node>     m_nodes;
+    std::vector<unsigned> m_order;
+    std::vector<T>        m_build_area;     // of every node when built
+};
@@ -0,0 +1,544 @@
+#pragma once
+
+#include "render.h"
+#include "scenefile.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <list>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Rendering spread over processes. A coordinator listens on a socket and
+// sends every worker that connects the scene, in the binary scene file
+// form, and the render settings once. It then hands out tiles, keeping two
+// in flight per worker so none sits idle waiting for the next one, and
+// copies the pixels that come back into the frame. Workers that finish
+// sooner simply get more tiles, and the tiles of a worker whose connection
+// drops go back in the queue. While no worker is connected the coordinator
+// renders tiles itself.
+//
+// Addresses containing a '/' are Unix socket paths, anything else is
+// [host:]port over TCP. Messages are sent in host byte order, so all the
+// machines must share it; every message header carries a mark that reads
+// differently on a machine of the other byte order, which drops the
+// connection. A worker that holds tiles and sends nothing back for
+// DistributedSettings::timeout is dropped like one whose connection broke.
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#define DISTRIBUTED_RENDER 1
+
+#include <cerrno>
+#include <csignal>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+enum MessageType
+{
+    MSG_SETUP = 1,      // SetupRecord, then the scene: coordinator to worker
+    MSG_TILE,           // TileRecord: coordinator to worker
+    MSG_PIXELS,         // TileRecord, then 3 floats per pixel: worker to coordinator
+    MSG_DONE,           // no payload: coordinator to worker
+};
+
+struct MessageHeader
+{
+    uint32_t type;
+    uint32_t order;     // byte_order_mark
+    uint64_t size;      // of the payload
+};
+
+static const uint32_t byte_order_mark = 0x01020304;
+// largest payload accepted from a peer, which bounds what a broken or
+// hostile one can make us allocate
+static const uint64_t max_payload     = uint64_t(1) << 32;
+
+struct SetupRecord
+{
+    uint32_t width, height;
+    uint32_t max_depth;
+    float    min_weight;
+    uint32_t roulette;
+    uint32_t tile_size;
+    uint32_t packet;
+    uint32_t wavefront;
+    uint32_t samples;
+    float    contrast;
+};
+
+struct TileRecord
+{
+    uint32_t id;
+    uint32_t x0, y0, x1, y1;
+};
+
+// connected stream socket, closed on destruction
+class Socket
+{
+public:
+    explicit Socket(int fd = -1) : m_fd(fd) {}
+    ~Socket()
+    {
+        if (m_fd >= 0)
+            close(m_fd);
+    }
+    Socket(const Socket&) = delete;
+    Socket& operator = (const Socket&) = delete;
+
+    int fd() const { return m_fd; }
+
+    bool send_all(const void* data, size_t size)
+    {
+        auto p = static_cast<const char*>(data);
+        while (size)
+        {
+            ssize_t n = ::send(m_fd, p, size, 0);
+            if (n <= 0)
+                return false;
+            p += n;
+            size -= n;
+        }
+        return true;
+    }
+    bool recv_all(void* data, size_t size)
+    {
+        auto p = static_cast<char*>(data);
+        while (size)
+        {
+            ssize_t n = ::recv(m_fd, p, size, 0);
+            if (n <= 0)
+                return false;
+            p += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    // a message whose payload is the two parts one after the other
+    bool send_message(uint32_t type, const void* a = NULL, size_t a_size = 0,
+                      const void* b = NULL, size_t b_size = 0)
+    {
+        MessageHeader h = { type, byte_order_mark, a_size + b_size };
+        return send_all(&h, sizeof(h)) && send_all(a, a_size) && send_all(b, b_size);
+    }
+    // false if the connection breaks, the peer has the other byte order or
+    // the payload is larger than limit
+    bool recv_message(MessageHeader& h, std::vector<unsigned char>& payload, uint64_t limit = max_payload)
+    {
+        if (!recv_all(&h, sizeof(h)))
+            return false;
+        if (h.order != byte_order_mark)
+        {
+            printf("peer has a different byte order\n");
+            return false;
+        }
+        if (h.size > limit)
+            return false;
+        payload.resize(h.size);
+        return recv_all(payload.data(), h.size);
+    }
+
+private:
+    int m_fd;
+};
+
+// socket address of a Unix path or [host:]port, for getaddrinfo hints
+// flags; false if it does not resolve
+inline bool resolve(const char* address, int flags, int* family, sockaddr_storage* addr, socklen_t* len)
+{
+    if (strchr(address, '/'))
+    {
+        sockaddr_un un = {};
+        if (strlen(address) >= sizeof(un.sun_path))
+            return false;
+        un.sun_family = AF_UNIX;
+        strcpy(un.sun_path, address);
+        memcpy(addr, &un, sizeof(un));
+        *len    = sizeof(un);
+        *family = AF_UNIX;
+        return true;
+    }
+    std::string host, port(address);
+    auto colon = port.rfind(':');
+    if (colon != std::string::npos)
+    {
+        host = port.substr(0, colon);
+        port = port.substr(colon + 1);
+    }
+    addrinfo hints = {}, *info;
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags    = flags;
+    if (getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(), &hints, &info))
+        return false;
+    memcpy(addr, info->ai_addr, info->ai_addrlen);
+    *len    = info->ai_addrlen;
+    *family = info->ai_family;
+    freeaddrinfo(info);
+    return true;
+}
+
+// listening socket on address, or -1
+inline int listen_on(const char* address)
+{
+    int family;
+    sockaddr_storage addr;
+    socklen_t len;
+    if (!resolve(address, AI_PASSIVE, &family, &addr, &len))
+        return -1;
+    int fd = socket(family, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    int on = 1;
+    if (family == AF_UNIX)
+        unlink(address);
+    else
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), len) || listen(fd, 64))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// socket connected to address, or -1 once retries have run out
+inline int connect_to(const char* address, unsigned retries = 50)
+{
+    int family;
+    sockaddr_storage addr;
+    socklen_t len;
+    if (!resolve(address, 0, &family, &addr, &len))
+        return -1;
+    for (unsigned i = 0; i <= retries; ++i)
+    {
+        int fd = socket(family, SOCK_STREAM, 0);
+        if (fd < 0)
+            return -1;
+        if (!connect(fd, reinterpret_cast<sockaddr*>(&addr), len))
+            return fd;
+        close(fd);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    return -1;
+}
+
+// Pixels of tile t of a width x height frame, row by row. The tile is
+// rendered with a one pixel apron so antialiasing compares the same
+// neighbours as in a render of the whole frame.
+inline void render_tile(const Scene<float>& scene, ThreadPool& pool, RenderSettings settings,
+                        unsigned width, unsigned height, const TileRecord& t, std::vector<float>& pixels)
+{
+    unsigned x0 = t.x0 ? t.x0 - 1 : 0, x1 = std::min(t.x1 + 1, width);
+    unsigned y0 = t.y0 ? t.y0 - 1 : 0, y1 = std::min(t.y1 + 1, height);
+    Framebuffer fb(x1 - x0, y1 - y0);
+    settings.frame_width  = width;
+    settings.frame_height = height;
+    settings.window_x     = x0;
+    settings.window_y     = y0;
+    render(scene, fb, pool, settings);
+
+    pixels.clear();
+    for (unsigned y = t.y0; y < t.y1; ++y)
+    {
+        const float* row = fb.pixel(t.x0 - x0, y - y0);
+        pixels.insert(pixels.end(), row, row + 3 * (t.x1 - t.x0));
+    }
+}
+
+// Serve the coordinator at address until it is done; returns the exit
+// code for the worker process.
+inline int run_worker(const char* address, unsigned threads)
+{
+    signal(SIGPIPE, SIG_IGN);
+    Socket coordinator(connect_to(address));
+    if (coordinator.fd() < 0)
+    {
+        printf("cannot connect to %s\n", address);
+        return 1;
+    }
+
+    ThreadPool                 pool(threads);
+    Scene<float>               scene;
+    SetupRecord                setup = {};
+    RenderSettings             settings;
+    MessageHeader              h;
+    std::vector<unsigned char> payload;
+    std::vector<float>         pixels;
+    while (coordinator.recv_message(h, payload))
+    {
+        if (h.type == MSG_SETUP && payload.size() >= sizeof(setup))
+        {
+            memcpy(&setup, payload.data(), sizeof(setup));
+            SceneView view;
+            if (!map_binary_scene(payload.data() + sizeof(setup), payload.size() - sizeof(setup), view) ||
+                !load_scene(view, scene))
+            {
+                printf("worker: bad scene\n");
+                return 1;
+            }
+            scene.max_depth    = setup.max_depth;
+            scene.min_weight   = setup.min_weight;
+            scene.roulette     = setup.roulette;
+            scene.build();
+            settings.tile_size = setup.tile_size;
+            settings.packet    = std::min(setup.packet, packet_width());
+            settings.wavefront = setup.wavefront;
+            settings.samples   = setup.samples;
+            settings.contrast  = setup.contrast;
+        }
+        else if (h.type == MSG_TILE && payload.size() == sizeof(TileRecord) && setup.width)
+        {
+            TileRecord t;
+            memcpy(&t, payload.data(), sizeof(t));
+            if (t.x1 > setup.width || t.y1 > setup.height || t.x0 >= t.x1 || t.y0 >= t.y1)
+                return 1;
+            render_tile(scene, pool, settings, setup.width, setup.height, t, pixels);
+            if (!coordinator.send_message(MSG_PIXELS, &t, sizeof(t), pixels.data(), pixels.size() * sizeof(float)))
+                break;
+        }
+        else if (h.type == MSG_DONE)
+            return 0;
+        else
+            return 1;
+    }
+    printf("worker: lost the coordinator\n");
+    return 1;
+}
+
+struct DistributedSettings
+{
+    const char* address   = NULL;   // to listen on
+    unsigned    tile_size = 64;     // handed out at a time
+    unsigned    spawn     = 0;      // local worker processes to start
+    unsigned    threads   = 1;      // for each of them
+    const char* program   = NULL;   // executable to start them from
+    unsigned    timeout   = 60;     // seconds a worker may hold tiles without answering
+};
+
+// start n local worker processes connecting to address; returns their pids
+inline std::vector<pid_t> spawn_workers(const DistributedSettings& d)
+{
+    std::vector<pid_t> pids;
+    std::string threads = std::to_string(d.threads);
+    for (unsigned i = 0; i < d.spawn; ++i)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            const char* argv[] = { d.program, "-connect", d.address, "-t", threads.c_str(), NULL };
+            execvp(d.program, const_cast<char* const*>(argv));
+            _exit(127);
+        }
+        if (pid > 0)
+            pids.push_back(pid);
+    }
+    return pids;
+}
+
+// Render fb as coordinator of the workers that connect to d.address.
+// Returns false if the scene cannot be sent or the socket not opened.
+inline bool render_distributed(const Scene<float>& scene, Framebuffer& fb, ThreadPool& pool,
+                               const RenderSettings& settings, const DistributedSettings& d)
+{
+    signal(SIGPIPE, SIG_IGN);
+
+    // everything a worker needs, sent as is to each one
+    SceneData data;
+    if (!describe_scene(scene, data))
+    {
+        printf("the scene holds objects or materials that cannot be sent to workers\n");
+        return false;
+    }
+    SetupRecord setup = { fb.width, fb.height, scene.max_depth, scene.min_weight, scene.roulette,
+                          settings.tile_size, settings.packet, settings.wavefront, settings.samples,
+                          settings.contrast };
+    std::vector<unsigned char> message(reinterpret_cast<unsigned char*>(&setup),
+                                       reinterpret_cast<unsigned char*>(&setup + 1));
+    write_binary_scene(data.view(), [&] (const void* p, size_t size) {
+        message.insert(message.end(), static_cast<const unsigned char*>(p),
+                       static_cast<const unsigned char*>(p) + size);
+        return true;
+    });
+
+    Socket listener(listen_on(d.address));
+    if (listener.fd() < 0)
+    {
+        printf("cannot listen on %s\n", d.address);
+        return false;
+    }
+    auto children = spawn_workers(d);
+
+    std::vector<TileRecord> tiles;
+    for (unsigned y = 0; y < fb.height; y += d.tile_size)
+        for (unsigned x = 0; x < fb.width; x += d.tile_size)
+            tiles.push_back({ unsigned(tiles.size()), x, y, std::min(x + d.tile_size, fb.width),
+                              std::min(y + d.tile_size, fb.height) });
+    std::deque<unsigned> pending;
+    for (auto& t: tiles)
+        pending.push_back(t.id);
+    std::vector<bool> done(tiles.size(), false);
+    size_t remaining = tiles.size();
+
+    typedef std::chrono::steady_clock Clock;
+    struct Worker
+    {
+        Socket                socket;
+        std::vector<unsigned> tiles;        // in flight
+        unsigned              number;
+        unsigned              rendered = 0;
+        Clock::time_point     heard;        // last answer, or when it was given work while idle
+        explicit Worker(int fd, unsigned n) : socket(fd), number(n), heard(Clock::now()) {}
+    };
+    std::list<Worker> workers;
+    unsigned connected = 0, local = 0;
+
+    auto put = [&] (const TileRecord& t, const float* pixels) {
+        for (unsigned y = t.y0; y < t.y1; ++y, pixels += 3 * (t.x1 - t.x0))
+            std::copy(pixels, pixels + 3 * (t.x1 - t.x0), fb.pixel(t.x0, y));
+        done[t.id] = true;
+        --remaining;
+    };
+    // keep two tiles in flight
+    auto assign = [&] (Worker& w) {
+        while (w.tiles.size() < 2 && !pending.empty())
+        {
+            unsigned id = pending.front();
+            pending.pop_front();
+            if (done[id])
+                continue;
+            if (w.tiles.empty())
+                w.heard = Clock::now();
+            w.tiles.push_back(id);
+            if (!w.socket.send_message(MSG_TILE, &tiles[id], sizeof(TileRecord)))
+                return false;
+        }
+        return true;
+    };
+    auto lose = [&] (std::list<Worker>::iterator w) {
+        for (auto id: w->tiles)
+            if (!done[id])
+                pending.push_front(id);
+        printf("worker %u lost, %zu tiles handed out again\n", w->number, w->tiles.size());
+        workers.erase(w);
+    };
+
+    std::vector<pollfd>        fds;
+    std::vector<float>         pixels;
+    std::vector<unsigned char> payload;
+    uint64_t limit = sizeof(TileRecord) + 3 * sizeof(float) * uint64_t(d.tile_size) * d.tile_size;
+    while (remaining)
+    {
+        // drop workers that hold tiles and stopped answering, and give
+        // idle ones the tiles of workers lost since they last answered
+        for (auto w = workers.begin(); w != workers.end();)
+        {
+            auto next = std::next(w);
+            if (!w->tiles.empty() && Clock::now() - w->heard > std::chrono::seconds(d.timeout))
+            {
+                printf("worker %u timed out\n", w->number);
+                lose(w);
+            }
+            else if (w->tiles.empty() && !assign(*w))
+                lose(w);
+            w = next;
+        }
+        fds.assign(1, { listener.fd(), POLLIN, 0 });
+        for (auto& w: workers)
+            fds.push_back({ w.socket.fd(), POLLIN, 0 });
+        // give workers a second to turn up before rendering alone; with
+        // workers, wake up once a second to look for hung ones
+        int ready = poll(fds.data(), fds.size(), !workers.empty() || !local ? 1000 : 0);
+        if (ready < 0 && errno != EINTR)
+            return false;
+        if (ready <= 0)
+        {
+            // nobody to hand tiles to
+            if (workers.empty() && !pending.empty())
+            {
+                unsigned id = pending.front();
+                pending.pop_front();
+                render_tile(scene, pool, settings, fb.width, fb.height, tiles[id], pixels);
+                put(tiles[id], pixels.data());
+                ++local;
+            }
+            continue;
+        }
+
+        // workers come first, so the new ones are not in fds yet
+        auto w = workers.begin();
+        for (size_t i = 1; i < fds.size(); ++i)
+        {
+            auto next = std::next(w);
+            if (fds[i].revents)
+            {
+                MessageHeader h;
+                TileRecord    t;
+                bool ok = w->socket.recv_message(h, payload, limit) && h.type == MSG_PIXELS &&
+                          payload.size() >= sizeof(t);
+                w->heard = Clock::now();
+                if (ok)
+                {
+                    memcpy(&t, payload.data(), sizeof(t));
+                    auto slot = std::find(w->tiles.begin(), w->tiles.end(), t.id);
+                    ok = slot != w->tiles.end() &&
+                         payload.size() == sizeof(t) + sizeof(float) * 3 *
+                                           (tiles[t.id].x1 - tiles[t.id].x0) * (tiles[t.id].y1 - tiles[t.id].y0);
+                    if (ok)
+                    {
+                        w->tiles.erase(slot);
+                        ++w->rendered;
+                        if (!done[t.id])
+                            put(tiles[t.id], reinterpret_cast<const float*>(payload.data() + sizeof(t)));
+                    }
+                }
+                if (!ok || !assign(*w))
+                    lose(w);
+            }
+            w = next;
+        }
+        if (fds[0].revents & POLLIN)
+        {
+            int fd = accept(listener.fd(), NULL, NULL);
+            if (fd >= 0)
+            {
+                workers.emplace_back(fd, ++connected);
+                auto& w = workers.back();
+                if (!w.socket.send_message(MSG_SETUP, message.data(), message.size()) || !assign(w))
+                    lose(std::prev(workers.end()));
+            }
+        }
+    }
+
+    for (auto& w: workers)
+    {
+        w.socket.send_message(MSG_DONE);
+        printf("worker %u rendered %u tiles\n", w.number, w.rendered);
+    }
+    if (local)
+        printf("coordinator rendered %u tiles\n", local);
+    workers.clear();
+    if (strchr(d.address, '/'))
+        unlink(d.address);
+    // a worker dropped as hung may never look at its socket again
+    for (auto pid: children)
+    {
+        pid_t exited = 0;
+        for (int i = 0; i < 50 && !(exited = waitpid(pid, NULL, WNOHANG)); ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (!exited)
+        {
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, 0);
+        }
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "vecmat.h"
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+// Linear RGB image the renderer writes into; presentation and file output
+// convert from it.
+struct Framebuffer
+{
+    unsigned           width;
+    unsigned           height;
+    std::vector<float> pixels;      // 3 floats per pixel, rows top to bottom
+
+    Framebuffer(unsigned w, unsigned h) :
+        width(w), height(h), pixels(3 * size_t(w) * h)
+    {}
+
+    float*       pixel(unsigned x, unsigned y)       { return &pixels[3 * (size_t(y) * width + x)]; }
+    const float* pixel(unsigned x, unsigned y) const { return &pixels[3 * (size_t(y) * width + x)]; }
+
+    template <typename T>
+    void set(unsigned x, unsigned y, const Vec3<T>& color)
+    {
+        std::copy(color.begin(), color.end(), pixel(x, y));
+    }
+};
+
+// gamma corrected 8 bit value of a linear intensity; PostProcess gives the
+// same without pow
+inline int to_8bit(float x)
+{
+    return std::min(255, int(pow(x, 1/2.2) * 255 + 0.5));
+}
+
+// How far image a is from image b, which must be the same size, in 8 bit
+// display units over every channel value
+struct ImageDifference
+{
+    double   rms        = 0;
+    int      max        = 0;
+    unsigned max_x      = 0;    // pixel where it is largest
+    unsigned max_y      = 0;
+    double   changed    = 0;    // share of values that differ at all
+    float    max_linear = 0;    // largest difference before conversion
+};
+
+inline ImageDifference difference(const Framebuffer& a, const Framebuffer& b)
+{
+    ImageDifference d;
+    double sum = 0;
+    size_t changed = 0;
+    for (size_t i = 0; i < a.pixels.size(); ++i)
+    {
+        int e = std::abs(to_8bit(a.pixels[i]) - to_8bit(b.pixels[i]));
+        sum += e * e;
+        changed += e != 0;
+        d.max_linear = std::max(d.max_linear, std::abs(a.pixels[i] - b.pixels[i]));
+        if (e > d.max)
+        {
+            d.max   = e;
+            d.max_x = unsigned(i / 3 % a.width);
+            d.max_y = unsigned(i / 3 / a.width);
+        }
+    }
+    d.rms     = std::sqrt(sum / std::max<size_t>(1, a.pixels.size()));
+    d.changed = double(changed) / std::max<size_t>(1, a.pixels.size());
+    return d;
+}
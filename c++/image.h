@@ -0,0 +1,153 @@
+#pragma once
+
+#include "framebuffer.h"
+#include "postprocess.h"
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <string>
+
+// Image file output: binary PPM (8 bit, gamma corrected), PFM (linear
+// float) and PNG (8 bit, gamma corrected). The 8 bit formats go through
+// the given PostProcess; PFM keeps the values as rendered. Functions
+// return false on I/O errors.
+
+inline bool write_ppm(const char* path, const Framebuffer& fb, const PostProcess& post = PostProcess())
+{
+    FILE* f = fopen(path, "wb");
+    if (!f)
+        return false;
+    fprintf(f, "P6\n%u %u\n255\n", fb.width, fb.height);
+    std::vector<unsigned char> row(3 * fb.width);
+    for (unsigned y = 0; y < fb.height; ++y)
+    {
+        post.convert(fb.pixel(0, y), row.data(), row.size());
+        if (fwrite(row.data(), 1, row.size(), f) != row.size())
+        {
+            fclose(f);
+            return false;
+        }
+    }
+    return fclose(f) == 0;
+}
+
+inline bool write_pfm(const char* path, const Framebuffer& fb)
+{
+    FILE* f = fopen(path, "wb");
+    if (!f)
+        return false;
+    // negative scale means little endian; rows are stored bottom to top
+    const uint16_t probe = 1;
+    bool little = *reinterpret_cast<const unsigned char*>(&probe) == 1;
+    fprintf(f, "PF\n%u %u\n%s\n", fb.width, fb.height, little ? "-1.0" : "1.0");
+    for (unsigned y = fb.height; y-- > 0; )
+        if (fwrite(fb.pixel(0, y), sizeof(float), 3 * size_t(fb.width), f) != 3 * size_t(fb.width))
+        {
+            fclose(f);
+            return false;
+        }
+    return fclose(f) == 0;
+}
+
+namespace png
+{
+    inline uint32_t crc(const unsigned char* p, size_t n, uint32_t c = 0xffffffff)
+    {
+        static uint32_t table[256];
+        static bool init = false;
+        if (!init)
+        {
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t v = i;
+                for (int k = 0; k < 8; ++k)
+                    v = (v & 1) ? 0xedb88320 ^ (v >> 1) : v >> 1;
+                table[i] = v;
+            }
+            init = true;
+        }
+        for (size_t i = 0; i < n; ++i)
+            c = table[(c ^ p[i]) & 0xff] ^ (c >> 8);
+        return c;
+    }
+
+    inline void put32(std::vector<unsigned char>& out, uint32_t v)
+    {
+        out.push_back(v >> 24);
+        out.push_back(v >> 16);
+        out.push_back(v >> 8);
+        out.push_back(v);
+    }
+
+    inline bool chunk(FILE* f, const char* type, const std::vector<unsigned char>& data)
+    {
+        std::vector<unsigned char> c;
+        put32(c, data.size());
+        c.insert(c.end(), type, type + 4);
+        c.insert(c.end(), data.begin(), data.end());
+        put32(c, crc(c.data() + 4, c.size() - 4) ^ 0xffffffff);
+        return fwrite(c.data(), 1, c.size(), f) == c.size();
+    }
+}
+
+// PNG with the image data in uncompressed deflate blocks, which keeps the
+// writer free of a zlib dependency
+inline bool write_png(const char* path, const Framebuffer& fb, const PostProcess& post = PostProcess())
+{
+    FILE* f = fopen(path, "wb");
+    if (!f)
+        return false;
+    static const unsigned char signature[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+    bool ok = fwrite(signature, 1, 8, f) == 8;
+
+    std::vector<unsigned char> header;
+    png::put32(header, fb.width);
+    png::put32(header, fb.height);
+    header.push_back(8);        // bit depth
+    header.push_back(2);        // truecolor
+    header.insert(header.end(), 3, 0);
+    ok = ok && png::chunk(f, "IHDR", header);
+
+    // filter type 0 in front of every row
+    std::vector<unsigned char> raw;
+    raw.reserve((3 * size_t(fb.width) + 1) * fb.height);
+    for (unsigned y = 0; y < fb.height; ++y)
+    {
+        raw.push_back(0);
+        raw.resize(raw.size() + 3 * size_t(fb.width));
+        post.convert(fb.pixel(0, y), &raw[raw.size() - 3 * size_t(fb.width)], 3 * size_t(fb.width));
+    }
+
+    std::vector<unsigned char> z = { 0x78, 0x01 };
+    uint32_t a = 1, b = 0;
+    for (size_t pos = 0, n; pos < raw.size(); pos += n)
+    {
+        n = std::min<size_t>(65535, raw.size() - pos);
+        z.push_back(pos + n == raw.size());
+        z.push_back(n & 0xff);
+        z.push_back(n >> 8);
+        z.push_back(~n & 0xff);
+        z.push_back((~n >> 8) & 0xff);
+        z.insert(z.end(), raw.begin() + pos, raw.begin() + pos + n);
+        for (size_t i = pos; i < pos + n; ++i)
+        {
+            a = (a + raw[i]) % 65521;
+            b = (b + a) % 65521;
+        }
+    }
+    png::put32(z, (b << 16) | a);
+    ok = ok && png::chunk(f, "IDAT", z) && png::chunk(f, "IEND", std::vector<unsigned char>());
+    return fclose(f) == 0 && ok;
+}
+
+// pick the format from the file extension, PPM by default
+inline bool write_image(const char* path, const Framebuffer& fb, const PostProcess& post = PostProcess())
+{
+    std::string p(path);
+    std::string ext = p.size() >= 4 ? p.substr(p.size() - 4) : "";
+    if (ext == ".pfm" || ext == ".PFM")
+        return write_pfm(path, fb);
+    if (ext == ".png" || ext == ".PNG")
+        return write_png(path, fb, post);
+    return write_ppm(path, fb, post);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "objects.h"
+#include <memory>
+
+// A placed copy of shared geometry. Rays are moved into the geometry's
+// own space and intersected there, so a copy costs one transform and a
+// box whatever the geometry is; thousands of instances of one mesh keep a
+// single MeshData.
+template <typename T>
+class Instance : public Object<T>
+{
+public:
+    // to_world places the geometry in the scene; material, if given,
+    // replaces the geometry's own
+    Instance(std::shared_ptr<const Object<T>> geometry, const Mat<T, 4>& to_world,
+             const Material<T>* material = NULL) :
+        m_geometry(std::move(geometry)), m_to_object(affine_inverse(to_world)),
+        m_material(material ? material : &m_geometry->material())
+    {
+        AABB<T> local = m_geometry->bounds();
+        for (int i = 0; i < 8; ++i)
+            m_bounds.extend(transform_point(Vec3<T>{ i & 1 ? local.hi[0] : local.lo[0],
+                                                     i & 2 ? local.hi[1] : local.lo[1],
+                                                     i & 4 ? local.hi[2] : local.lo[2] }, to_world));
+    }
+
+    bool intersect(const Ray<T>& ray, T* distance = NULL, unsigned* part = NULL) const
+    {
+        return intersect_local(transform_point(ray.start, m_to_object),
+                               transform_vector(ray.dir, m_to_object), distance, part);
+    }
+    // Second half of intersect(), for a ray already in object space (see
+    // transform_rays()). Objects expect unit directions, so the distance
+    // found along the normalized ray is scaled back to the caller's.
+    bool intersect_local(const Vec3<T>& start, const Vec3<T>& dir, T* distance, unsigned* part = NULL) const
+    {
+        T length = dir.magnitude();
+        T d;
+        if (!m_geometry->intersect(Ray<T>(start, dir * (T(1) / length)), &d, part))
+            return false;
+        if (distance)
+            *distance = d / length;
+        return true;
+    }
+    // normals go back to the scene through the inverse transpose
+    Vec3<T> normal(const Vec3<T>& pos, unsigned part = 0) const
+    {
+        auto n = m_geometry->normal(transform_point(pos, m_to_object), part);
+        auto& m = m_to_object;
+        return Vec3<T>{ (n[0] * m[0][0] + n[1] * m[0][1]) + n[2] * m[0][2],
+                        (n[0] * m[1][0] + n[1] * m[1][1]) + n[2] * m[1][2],
+                        (n[0] * m[2][0] + n[1] * m[2][1]) + n[2] * m[2][2] }.normalized();
+    }
+    const Material<T>& material() const
+    {
+        return *m_material;
+    }
+    AABB<T> bounds() const
+    {
+        return m_bounds;
+    }
+    const Mat<T, 4>& to_object() const { return m_to_object; }
+
+private:
+    std::shared_ptr<const Object<T>> m_geometry;
+    Mat<T, 4>                        m_to_object;
+    const Material<T>*               m_material;
+    AABB<T>                          m_bounds;
+};
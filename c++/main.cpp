@@ -1,217 +1,530 @@
 #include "vecmat.h"
 #include "objects.h"
+#include "render.h"
+#include "scenes.h"
+#include "scenefile.h"
+#include "distributed.h"
+#include "image.h"
+#include "stream.h"
+#ifndef NO_SDL
 #include "SDL/SDL.h"
+#endif
 #include <list>
 #include <limits>
+#include <cstring>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <thread>
 
-const static unsigned width     = 1280;
-const static unsigned height    = 720;
-const static unsigned max_depth = 6;
-const static float    fov       = 45;
-const static float    pi        = 3.1415926536;
-
-#include <sys/time.h>
-class Timing
-{
-    timeval start_;
-public:
-	void start()
-	{
-        gettimeofday(&start_, NULL);
-	}
-	int stop()
-	{
-        timeval end;
-        gettimeofday(&end, NULL);
-        double elapsed = (end.tv_sec - start_.tv_sec) * 1000000.0;
-        elapsed += (end.tv_usec - start_.tv_usec);
-        return int(elapsed);
-    }
-};
+// the two precisions the renderer is built for, chosen with -P at run time
+template void render<float>(const Scene<float>&, Framebuffer&, ThreadPool&, const RenderSettings&, const TileDone&);
+template void render<double>(const Scene<double>&, Framebuffer&, ThreadPool&, const RenderSettings&, const TileDone&);
 
-template <typename T>
-struct Scene
+#ifndef NO_SDL
+// post-processing into the window surface's pixel format
+PostProcess surface_post(const PostSettings& settings, const SDL_Surface* surface)
+{
+    PixelFormat format;
+    format.rshift = surface->format->Rshift;
+    format.gshift = surface->format->Gshift;
+    format.bshift = surface->format->Bshift;
+    return PostProcess(settings, format);
+}
+
+// convert a rectangle of the framebuffer into the window surface's pixels;
+// the software surface needs no locking, so workers may call this
+void copy_rect(const Framebuffer& fb, SDL_Surface* surface, const PostProcess& post,
+               unsigned x0, unsigned y0, unsigned x1, unsigned y1)
+{
+    post.pack(fb, surface->pixels, surface->pitch, x0, y0, x1, y1);
+}
+
+// copy the framebuffer to the window surface, tile by tile over the pool
+void present(const Framebuffer& fb, SDL_Surface* surface, const PostProcess& post, ThreadPool& pool)
+{
+    SDL_LockSurface(surface);
+    post.pack(fb, surface->pixels, surface->pitch, pool);
+    SDL_UnlockSurface(surface);
+    SDL_UpdateRect(surface, 0, 0, 0, 0);
+}
+#endif
+
+struct Options
 {
-    std::list<Object<T>*> objects;
-    std::list<Light<T>*>  lights;
+    unsigned       width     = 1280;
+    unsigned       height    = 720;
+    unsigned       max_depth = 6;
+    float          min_weight = 0;      // see Scene::min_weight
+    bool           roulette  = false;
+    const char*    scene     = NULL;    // scene file, see scenefile.h
+    const char*    texture   = NULL;    // texture file for the floor, see texture.h
+    unsigned       cache_mb  = 64;      // texture tile cache size
+    const char*    output    = NULL;    // image file; render headless if set
+    const char*    stats     = NULL;    // "text" or "json" ray statistics
+    unsigned       frames    = 0;       // animate for this many frames, 0 for a still
+    unsigned       band      = 0;       // stream the still in bands of this many rows, see stream.h
+    const char*    listen    = NULL;    // coordinate workers connecting here, see distributed.h
+    const char*    connect   = NULL;    // be a worker of the coordinator here
+    unsigned       spawn     = 0;       // local workers for the coordinator to start
+    const char*    precision = "float"; // "float", "double" or "compare" both
+    PostSettings   post;                // exposure and tone map of 8 bit output
+    unsigned       threads   = std::max(1u, std::thread::hardware_concurrency());
+    RenderSettings render;
 
-    ~Scene()
+    static bool valid_packet(int n) { return n == 0 || n == 4 || n == 8 || n == 16; }
+
+    Options(int argc, char *argv[])
     {
-        for (auto& o: objects)
-            delete o;
-        for (auto& l: lights)
-            delete l;
+        for (int i = 1; i < argc; ++i)
+        {
+            if (!strcmp(argv[i], "-w") && i + 1 < argc)
+                width = std::max(1, atoi(argv[++i]));
+            else if (!strcmp(argv[i], "-h") && i + 1 < argc)
+                height = std::max(1, atoi(argv[++i]));
+            else if (!strcmp(argv[i], "-d") && i + 1 < argc)
+                max_depth = std::min(std::max(0, atoi(argv[++i])), int(max_trace_depth));
+            else if (!strcmp(argv[i], "-m") && i + 1 < argc)
+                min_weight = std::max(0.0, atof(argv[++i]));
+            else if (!strcmp(argv[i], "-r"))
+                roulette = true;
+            else if (!strcmp(argv[i], "-f") && i + 1 < argc)
+                scene = argv[++i];
+            else if (!strcmp(argv[i], "-T") && i + 1 < argc)
+                texture = argv[++i];
+            else if (!strcmp(argv[i], "-C") && i + 1 < argc)
+                cache_mb = std::max(1, atoi(argv[++i]));
+            else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+                output = argv[++i];
+            else if (!strcmp(argv[i], "-S") && i + 1 < argc &&
+                     (!strcmp(argv[i + 1], "text") || !strcmp(argv[i + 1], "json")))
+                stats = argv[++i];
+            else if (!strcmp(argv[i], "-A") && i + 1 < argc)
+                frames = std::max(0, atoi(argv[++i]));
+            else if (!strcmp(argv[i], "-b") && i + 1 < argc)
+                band = std::max(0, atoi(argv[++i]));
+            else if (!strcmp(argv[i], "-listen") && i + 1 < argc)
+                listen = argv[++i];
+            else if (!strcmp(argv[i], "-connect") && i + 1 < argc)
+                connect = argv[++i];
+            else if (!strcmp(argv[i], "-spawn") && i + 1 < argc)
+                spawn = std::max(0, atoi(argv[++i]));
+            else if (!strcmp(argv[i], "-e") && i + 1 < argc)
+                post.exposure = std::max(0.0, atof(argv[++i]));
+            else if (!strcmp(argv[i], "-tonemap") && i + 1 < argc &&
+                     (!strcmp(argv[i + 1], "clamp") || !strcmp(argv[i + 1], "reinhard")))
+                post.tonemap = !strcmp(argv[++i], "reinhard") ? TONEMAP_REINHARD : TONEMAP_CLAMP;
+            else if (!strcmp(argv[i], "-P") && i + 1 < argc &&
+                     (!strcmp(argv[i + 1], "float") || !strcmp(argv[i + 1], "double") ||
+                      !strcmp(argv[i + 1], "compare")))
+                precision = argv[++i];
+            else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+                threads = std::max(1, atoi(argv[++i]));
+            else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+                render.tile_size = std::max(1, atoi(argv[++i]));
+            else if (!strcmp(argv[i], "-a") && i + 1 < argc)
+                render.samples = std::min(std::max(1, atoi(argv[++i])), 16);
+            else if (!strcmp(argv[i], "-c") && i + 1 < argc)
+                render.contrast = atof(argv[++i]);
+            else if (!strcmp(argv[i], "-W"))
+                render.wavefront = true;
+            else if (!strcmp(argv[i], "-p") && i + 1 < argc && valid_packet(atoi(argv[i + 1])))
+                render.packet = std::min(unsigned(atoi(argv[++i])), packet_width());
+            else
+            {
+                printf("usage: %s [-w width] [-h height] [-d max_depth] [-m min_weight] [-r]\n"
+                       "       [-f scene.txt|scene.bin | -T floor.tex [-C cache_mb]]\n"
+                       "       [-o image.ppm|pfm|png] [-e exposure] [-tonemap clamp|reinhard]\n"
+                       "       [-S text|json] [-t threads] [-s tile_size]\n"
+                       "       [-p 0|4|8|16] [-W] [-a max_samples] [-c contrast] [-P float|double|compare]\n"
+                       "       [-A frames [-o frame%%04d.png] | -b band_rows [-o image.ppm|pfm]]\n"
+                       "       [-listen [host:]port|path [-spawn workers]] [-connect [host:]port|path]\n",
+                       argv[0]);
+                exit(1);
+            }
+        }
+#ifdef NO_SDL
+        if (!output)
+            output = frames ? "frame%04d.ppm" : "raytracer.ppm";
+#endif
+        if (listen && !output)
+            output = "raytracer.ppm";
     }
 };
 
-template<typename T>
-Vec3<T> trace(const Ray<T>& ray, const Scene<T>& scene, int depth)
+double milliseconds_since(std::chrono::steady_clock::time_point start)
 {
-	T nearest = std::numeric_limits<T>::max();
-	const Object<T>* obj = NULL;
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
 
-    // search the scene for nearest intersection
-    for(auto& o: scene.objects)
+// File name of a frame from an output pattern with exactly one %d for the
+// frame number, which may be zero padded to a width (%04d); %% is a
+// literal %. Returns false for any other pattern; the pattern comes from
+// the command line and is never handed to printf.
+bool frame_name(const char* pattern, unsigned frame, std::string& name)
+{
+    name.clear();
+    int conversions = 0;
+    for (const char* p = pattern; *p; ++p)
     {
-		T distance = std::numeric_limits<T>::max();
-		if (o->intersect(ray, &distance))
+        if (*p != '%')
         {
-			if (distance < nearest)
-            {
-				nearest = distance;
-				obj = o;
-			}
-		}
-	}
+            name += *p;
+            continue;
+        }
+        if (*++p == '%')
+        {
+            name += '%';
+            continue;
+        }
+        bool     zero  = *p == '0';
+        unsigned width = 0;
+        for (; *p >= '0' && *p <= '9'; ++p)
+            width = std::min(width * 10 + unsigned(*p - '0'), 64u);
+        if (*p != 'd' || conversions++)
+            return false;
+        std::string digits = std::to_string(frame);
+        if (digits.size() < width)
+            name.append(width - digits.size(), zero ? '0' : ' ');
+        name += digits;
+    }
+    return conversions == 1;
+}
 
-	if (!obj)                   // no hit
-        return Vec3<T>(0);      // return black
+// move the spheres to where they are in frame and refit the scene to them;
+// the time this takes is reported apart from the trace time
+template <typename T>
+void animate(Scene<T>& scene, Orbits<T>& orbits, unsigned frame)
+{
+    auto start = std::chrono::steady_clock::now();
+    orbits(frame);
+    bool rebuilt = scene.update();
+    printf("frame %u: scene update %.2f ms (%s)\n", frame, milliseconds_since(start),
+           rebuilt ? "rebuilt" : "refit");
+}
+
+void print_stats(const Options& options)
+{
+    if (!options.stats)
+        return;
+    if (options.texture && strcmp(options.stats, "json"))
+        TileCache::instance().stats().print(stdout);
+#ifdef RAY_STATS
+    RayStats stats = StatsRegistry::instance().collect();
+    if (!strcmp(options.stats, "json"))
+        stats.write_json(stdout);
+    else
+        stats.print(stdout);
+#else
+    printf("ray statistics are not compiled in, build with make STATS=1\n");
+#endif
+}
+
+#ifndef NO_SDL
+// Show the frame as it is rendered: a background thread runs passes of
+// increasing quality, one ray per 4x4 block, per 2x2 block, then every
+// pixel (plus antialiasing if enabled). Workers copy each finished tile to
+// the surface; the main thread keeps handling events and pushes the
+// updated rectangles to the screen. Animations are shown frame by frame at
+// full quality.
+template <typename T>
+int interactive(Scene<T>& scene, Framebuffer& fb, ThreadPool& pool, const Options& options)
+{
+	SDL_Init(SDL_INIT_VIDEO);
+    atexit(SDL_Quit);
+    SDL_Surface* screen = SDL_SetVideoMode(fb.width, fb.height, 32, SDL_SWSURFACE);
+
+	if (!screen)
+		return 1;
+    PostProcess post = surface_post(options.post, screen);
 
-	auto point_of_hit = ray.start + ray.dir * nearest;
-	auto normal = obj->normal(point_of_hit);
-    bool inside = false;
+#ifdef EMSCRIPTEN
+    render(scene, fb, pool, options.render);
+    present(fb, screen, post, pool);
+#else
+    std::mutex            mutex;
+    std::vector<SDL_Rect> dirty;
+    std::atomic<bool>     quit(false), finished(false);
 
-    // normal should always face the origin
-	if (normal.dot(ray.dir) > 0)
+    std::thread renderer([&] {
+        Orbits<T> orbits(scene);
+        auto steps = options.frames ? std::vector<unsigned>{ 1 } : std::vector<unsigned>{ 4, 2, 1 };
+        for (unsigned frame = 0; frame < std::max(1u, options.frames); ++frame)
+        {
+            if (options.frames)
+                animate(scene, orbits, frame);
+            auto start = std::chrono::steady_clock::now();
+            for (unsigned step: steps)
+            {
+                RenderSettings settings = options.render;
+                settings.step = step;
+                render(scene, fb, pool, settings, [&] (unsigned x0, unsigned y0, unsigned x1, unsigned y1) {
+                    copy_rect(fb, screen, post, x0, y0, x1, y1);
+                    std::lock_guard<std::mutex> lock(mutex);
+                    dirty.push_back({ Sint16(x0), Sint16(y0), Uint16(x1 - x0), Uint16(y1 - y0) });
+                    return !quit;
+                });
+                if (quit)
+                    return;
+                printf("pass 1/%u done at %.0f ms\n", step * step, milliseconds_since(start));
+            }
+        }
+        print_stats(options);
+        finished = true;
+    });
+
+    SDL_Event event;
+    for (;;)
     {
-        inside = true;
-        normal = -normal;
+        while (SDL_PollEvent(&event))
+            if (event.type == SDL_QUIT ||
+                (event.type == SDL_KEYUP && event.key.keysym.sym == SDLK_ESCAPE))
+                quit = true;
+        bool last = finished;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!dirty.empty())
+                SDL_UpdateRects(screen, dirty.size(), &dirty[0]);
+            dirty.clear();
+        }
+        if (quit || last)
+            break;
+        SDL_Delay(10);
     }
+    renderer.join();
+    if (quit)
+        return 0;
 
-    Vec3<T> color(0);
-    const Material<T>& material = obj->material();
-	Vec3<T> diffuse_color = material.diffuse(point_of_hit);
-    T       reflection_ratio = material.reflection();
+    while (SDL_WaitEvent(&event))
+    {
+        switch (event.type)
+        {
+        case SDL_KEYUP:
+            if (event.key.keysym.sym == SDLK_ESCAPE)
+                return 0;
+            break;
+        case SDL_QUIT:
+            return 0;
+        }
+    }
+#endif
+    return 0;
+}
+#endif
 
-    // compute diffuse light
-    // add up incoming light from all light sources
-    for(auto& l: scene.lights)
+// make the scene the options ask for
+template <typename T>
+bool make_scene(const Options& options, Scene<T>& scene)
+{
+    if (options.texture)
+    {
+        auto texture = std::make_shared<Texture>();
+        if (!texture->open(options.texture))
+            return false;
+        TileCache::instance().set_capacity(size_t(options.cache_mb) << 20);
+        textured_scene(scene, std::shared_ptr<const Texture>(texture),
+                       T(std::tan(fov / 360 * pi) * 2 / options.height));
+    }
+    else if (!options.scene)
+        default_scene(scene);
+    else
     {
-        auto light_direction = (l->position() - point_of_hit).normalized();
+        auto start = std::chrono::steady_clock::now();
+        if (!load_scene(options.scene, scene))
+            return false;
+        printf("loading time %.0f ms\n", milliseconds_since(start));
+    }
+    scene.max_depth = options.max_depth;
+    scene.min_weight = T(options.min_weight);
+    scene.roulette  = options.roulette;
+    scene.build();
+    return true;
+}
 
-        // go through the scene check whether we're blocked from the lights
-        bool blocked = std::any_of(scene.objects.begin(), scene.objects.end(), [=] (const Object<T>* o) {
-                return o->intersect({point_of_hit + normal * 1e-5, light_direction}); });
-        if (!blocked)
-            color += l->color()
-                * std::max(T(0), normal.dot(light_direction))
-                * diffuse_color
-                * (T(1) - reflection_ratio);
+#ifdef DISTRIBUTED_RENDER
+int coordinate(const Scene<float>& scene, Framebuffer& fb, ThreadPool& pool,
+               const Options& options, const char* program)
+{
+    if (options.frames)
+    {
+        printf("animations cannot be rendered distributed\n");
+        return 1;
     }
+    DistributedSettings distributed;
+    distributed.address = options.listen;
+    distributed.spawn   = options.spawn;
+    distributed.threads = std::max(1u, options.threads / std::max(1u, options.spawn));
+    distributed.program = program;
+    auto start = std::chrono::steady_clock::now();
+    if (!render_distributed(scene, fb, pool, options.render, distributed))
+        return 1;
+    printf("rendering time %.0f ms\n", milliseconds_since(start));
+    if (!write_image(options.output, fb, PostProcess(options.post)))
+    {
+        printf("cannot write %s\n", options.output);
+        return 1;
+    }
+    return 0;
+}
 
-    T facing = std::max(T(0), -ray.dir.dot(normal));
-    T fresneleffect = reflection_ratio + (1 - reflection_ratio) * pow((1 - facing), 5);
+// workers trace in float, see distributed.h
+int coordinate(const Scene<double>&, Framebuffer&, ThreadPool&, const Options&, const char*)
+{
+    printf("distributed rendering is only done in float\n");
+    return 1;
+}
+#endif
 
-    // compute reflection
-    if (depth < max_depth && reflection_ratio > 0)
+// render the still band by band straight to the output file
+template <typename T>
+int stream(const Scene<T>& scene, ThreadPool& pool, const Options& options)
+{
+    if (options.frames || options.listen)
+    {
+        printf("only stills rendered here are streamed\n");
+        return 1;
+    }
+    if (!ImageStream::streamable(options.output))
+    {
+        printf("streamed images are written as .ppm or .pfm\n");
+        return 1;
+    }
+    auto start = std::chrono::steady_clock::now();
+    if (!render_streaming(scene, pool, options.render, options.width, options.height, options.band,
+                          options.output, PostProcess(options.post)))
     {
-        auto reflection_direction = ray.dir + normal * 2 * ray.dir.dot(normal) * T(-1);
-        auto reflection = trace(Ray<T>(point_of_hit + normal * 1e-5, reflection_direction),
-                                scene, depth + 1);
-        color += reflection * fresneleffect;
+        printf("cannot write %s\n", options.output);
+        return 1;
     }
+    printf("rendering time %.0f ms\n", milliseconds_since(start));
+    print_stats(options);
+    return 0;
+}
+
+template <typename T>
+int run(const Options& options, const char* program)
+{
+    Scene<T> scene;
+    if (!make_scene(options, scene))
+        return 1;
+
+    ThreadPool pool(options.threads);
+    if (options.band && options.output)
+        return stream(scene, pool, options);
+    Framebuffer fb(options.width, options.height);
+
+#ifndef NO_SDL
+    if (!options.output)
+        return interactive(scene, fb, pool, options);
+#endif
+
+#ifdef DISTRIBUTED_RENDER
+    if (options.listen)
+        return coordinate(scene, fb, pool, options, program);
+#else
+    (void)program;
+#endif
 
-    // compute refraction
-    if (depth < max_depth && (material.transparency() > 0))
+    if (options.frames)
     {
-		auto CE = ray.dir.dot(normal) * T(-1);
-        auto ior = inside ? T(1) / material.ior() : material.ior();
-        auto eta = T(1) / ior;
-        auto GF = (ray.dir + normal * CE) * eta;
-        auto sin_t1_2 = 1 - CE * CE;
-        auto sin_t2_2 = sin_t1_2 * (eta * eta);
-        if (sin_t2_2 < T(1))
+        std::string name;
+        if (!frame_name(options.output, 0, name))
         {
-            auto GC = normal * sqrt(1 - sin_t2_2);
-            auto refraction_direction = GF - GC;
-            auto refraction = trace(Ray<T>(point_of_hit - normal * 1e-5, refraction_direction),
-                                    scene, depth + 1);
-            color += refraction * (1 - fresneleffect) * material.transparency();
+            printf("the output name of an animation needs one %%d for the frame number, like frame%%04d.png\n");
+            return 1;
         }
+        Orbits<T> orbits(scene);
+        for (unsigned frame = 0; frame < options.frames; ++frame)
+        {
+            animate(scene, orbits, frame);
+            auto start = std::chrono::steady_clock::now();
+            render(scene, fb, pool, options.render);
+            printf("frame %u: rendering time %.0f ms\n", frame, milliseconds_since(start));
+
+            frame_name(options.output, frame, name);
+            if (!write_image(name.c_str(), fb, PostProcess(options.post)))
+            {
+                printf("cannot write %s\n", name.c_str());
+                return 1;
+            }
+        }
+        print_stats(options);
+        return 0;
     }
 
-	return color;
+    auto start = std::chrono::steady_clock::now();
+	render(scene, fb, pool, options.render);
+	printf("rendering time %.0f ms\n", milliseconds_since(start));
+    print_stats(options);
+
+    if (!write_image(options.output, fb, PostProcess(options.post)))
+    {
+        printf("cannot write %s\n", options.output);
+        return 1;
+    }
+    return 0;
 }
 
+// best of a few renders of the scene in ms
 template <typename T>
-void render(const Scene<T>& scene, SDL_Surface* surface)
+double time_render(const Scene<T>& scene, Framebuffer& fb, ThreadPool& pool, const Options& options)
 {
-    SDL_LockSurface(surface);
+    double best = std::numeric_limits<double>::max();
+    for (int run = 0; run < 3; ++run)
+    {
+        auto start = std::chrono::steady_clock::now();
+        render(scene, fb, pool, options.render);
+        best = std::min(best, milliseconds_since(start));
+    }
+    return best;
+}
 
-    // eye at [0, 0, 0]
-    // screen plane at [x, y, -1]
-    Vec3<T> eye(0);
-    T h = tan(fov / 360 * 2 * pi / 2) * 2;
-    T w = h * width / height;
+// Render the still in both precisions and report what double costs and
+// how far the float image is from it. The output image, if named, is the
+// float one.
+int compare_precisions(const Options& options)
+{
+    Scene<float>  single;
+    Scene<double> twice;
+    if (!make_scene(options, single) || !make_scene(options, twice))
+        return 1;
+    Framebuffer fb(options.width, options.height), reference(options.width, options.height);
+    ThreadPool pool(options.threads);
+
+    double f = time_render(single, fb, pool, options);
+    double d = time_render(twice, reference, pool, options);
+    auto diff = difference(fb, reference);
+    printf("float  %8.0f ms\n", f);
+    printf("double %8.0f ms (%.2fx)\n", d, d / f);
+    printf("difference rms %.3f, max %d at %u,%u, %.2f%% of values changed, max linear %g\n",
+           diff.rms, diff.max, diff.max_x, diff.max_y, 100 * diff.changed, diff.max_linear);
+    printf("%s is the better choice for this scene\n", f <= d && diff.max <= 1 ? "float" : "double");
 
-    auto row = reinterpret_cast<unsigned char*>(surface->pixels);
-    for (unsigned y = 0; y < height; ++y)
+    if (options.output && !write_image(options.output, fb, PostProcess(options.post)))
     {
-        auto p = reinterpret_cast<Uint32*>(row);
-        for (unsigned x = 0; x < width; ++x)
-        {
-            Vec3<T> direction = {(T(x) - width / 2) / width  * w,
-                                 (T(height)/2 - y) / height * h,
-                                 -1.0f };
-            direction.normalize();
-            auto pixel = trace(Ray<T>(eye, direction), scene, 0);
-            Vec3<int> rgb;
-            std::transform(pixel.begin(), pixel.end(), rgb.begin(), [] (T x) {
-                    return std::min(255, int(pow(x, 1/2.2) * 255 + 0.5)); });
-            // *p++ = SDL_MapRGB(surface->format, rgb[0], rgb[1], rgb[2]);
-            *p++ = rgb[2] | (rgb[1] << 8) | (rgb[0] << 16);
-            
-        }
-        row += surface->pitch;
+        printf("cannot write %s\n", options.output);
+        return 1;
     }
-    SDL_UnlockSurface(surface);
-    SDL_UpdateRect(surface, 0, 0, 0, 0);
+    return 0;
 }
 
 int main(int argc, char *argv[])
 {
-	SDL_Init(SDL_INIT_VIDEO);
-    atexit(SDL_Quit);
-    SDL_Surface* screen = SDL_SetVideoMode(width, height, 32, SDL_SWSURFACE);
-
-	if (!screen)
-		return 1;
-
-    CheckerBoard<float> checker_board;
-    Shiny<float> shiny;
-    Glass<float> glass;
-
-    Scene<float> scene;
-
-    // add objects
-    scene.objects = { new Sphere<float>({0, -10002, -20}, 10000, checker_board),
-                      new Sphere<float>({0, 2, -20},      4,     shiny),
-                      new Sphere<float>({5, 0, -15},      2,     shiny),
-                      new Sphere<float>({-5, 0, -15},     2,     shiny),
-                      new Sphere<float>({-2, -1, -10},    1,     glass) };
-    // add lights
-    scene.lights = { new Light<float>({-10, 20, 30},  {2, 2, 2}) };
-
-	Timing t;
-	t.start();
-	render(scene, screen);
-	int elapsed = t.stop();
-	printf("rendering time %d ms\n", elapsed/1000);
-
-#ifndef EMSCRIPTEN
-	SDL_Event event;
-	while (SDL_WaitEvent(&event))
-	{
-		switch (event.type)
-		{
-		case SDL_KEYUP:
-			if (event.key.keysym.sym == SDLK_ESCAPE)
-				return 0;
-			break;
-		case SDL_QUIT:
-			return 0;
-		}
-	}
+    Options options(argc, argv);
+#ifdef DISTRIBUTED_RENDER
+    if (options.connect)
+        return run_worker(options.connect, options.threads);
+#else
+    if (options.connect || options.listen)
+    {
+        printf("distributed rendering is not available on this platform\n");
+        return 1;
+    }
 #endif
-    return 0;
+
+    if (!strcmp(options.precision, "compare"))
+        return compare_precisions(options);
+    if (!strcmp(options.precision, "double"))
+        return run<double>(options, argv[0]);
+    return run<float>(options, argv[0]);
 }
@@ -1,5 +1,35 @@
 #pragma once
 
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+template<typename T>
+struct Material;
+
+// The closed set of ways a diffuse color is computed, each a Shader<T, S>
+// specialization below. Materials outside it are shaded through their
+// virtual interface.
+enum Shading
+{
+    SHADE_CONSTANT,     // color everywhere
+    SHADE_CHECKER,      // squares of color and black
+    SHADE_VIRTUAL,      // source->diffuse()
+};
+
+// A material as plain numbers, which the integrator reads without
+// virtual calls (see MaterialTable)
+template<typename T>
+struct MaterialParams
+{
+    Vec3<T>            color;
+    T                  reflection;
+    T                  transparency;
+    T                  ior;
+    Shading            shading;
+    const Material<T>* source;
+};
+
 template<typename T>
 struct Material
 {
@@ -7,6 +37,19 @@ struct Material
     virtual T       reflection()   const  { return T(0); }
     virtual T       transparency() const  { return T(0); }
     virtual T       ior()          const  { return T(1); }
+
+    // table entry of the material; those a shading kernel can draw say
+    // which one, the rest keep diffuse() as it is
+    virtual MaterialParams<T> params() const
+    {
+        return make_params(SHADE_VIRTUAL, diffuse(Vec3<T>(0)));
+    }
+
+protected:
+    MaterialParams<T> make_params(Shading shading, const Vec3<T>& color) const
+    {
+        return { color, reflection(), transparency(), ior(), shading, this };
+    }
 };
 
 template<typename T>
@@ -14,6 +57,8 @@ struct Shiny : Material<T>
 {
     Vec3<T> diffuse (const Vec3<T>& pos) const { return Vec3<T>{.6,.6,.6}; }
     T       reflection() const { return T(0.1); }
+
+    MaterialParams<T> params() const { return this->make_params(SHADE_CONSTANT, diffuse(Vec3<T>(0))); }
 };
 
 template<typename T>
@@ -27,6 +72,8 @@ struct CheckerBoard : Material<T>
             return { 0, 0, 0 };
     }
     T reflection() const { return T(0.1); }
+
+    MaterialParams<T> params() const { return this->make_params(SHADE_CHECKER, Vec3<T>(1)); }
 };
 
 template<typename T>
@@ -36,4 +83,113 @@ struct Glass : Material<T>
     T       reflection()   const { return T(0.1); }
     T       transparency() const { return T(.7); }
     T       ior()          const { return T(1.4); }
+
+    MaterialParams<T> params() const { return this->make_params(SHADE_CONSTANT, diffuse(Vec3<T>(0))); }
+};
+
+// Material whose properties are given at runtime, as in scene files. With
+// checker set the diffuse color alternates with black in the pattern of
+// CheckerBoard.
+template<typename T>
+struct Surface : Material<T>
+{
+    Vec3<T> color;
+    bool    checker      = false;
+    T       reflectivity = 0;
+    T       transparent  = 0;
+    T       index        = 1;
+
+    Vec3<T> diffuse (const Vec3<T>& pos) const
+    {
+        if (checker && !((int(pos[2]*.5) + int(pos[0]*.5)) % 2))
+            return { 0, 0, 0 };
+        return color;
+    }
+    T       reflection()   const { return reflectivity; }
+    T       transparency() const { return transparent; }
+    T       ior()          const { return index; }
+
+    MaterialParams<T> params() const
+    {
+        return this->make_params(checker ? SHADE_CHECKER : SHADE_CONSTANT, color);
+    }
+};
+
+// shading kernels, one per Shading
+template<typename T, int S>
+struct Shader;
+
+template<typename T>
+struct Shader<T, SHADE_CONSTANT>
+{
+    static Vec3<T> diffuse(const MaterialParams<T>& m, const Vec3<T>&) { return m.color; }
+};
+
+template<typename T>
+struct Shader<T, SHADE_CHECKER>
+{
+    static Vec3<T> diffuse(const MaterialParams<T>& m, const Vec3<T>& pos)
+    {
+        if ((int(pos[2]*.5) + int(pos[0]*.5)) % 2)
+            return m.color;
+        return { 0, 0, 0 };
+    }
+};
+
+template<typename T>
+struct Shader<T, SHADE_VIRTUAL>
+{
+    static Vec3<T> diffuse(const MaterialParams<T>& m, const Vec3<T>& pos) { return m.source->diffuse(pos); }
+};
+
+// diffuse color of m at pos, for callers that shade one hit at a time
+template<typename T>
+Vec3<T> diffuse(const MaterialParams<T>& m, const Vec3<T>& pos)
+{
+    switch (m.shading)
+    {
+    case SHADE_CONSTANT: return Shader<T, SHADE_CONSTANT>::diffuse(m, pos);
+    case SHADE_CHECKER:  return Shader<T, SHADE_CHECKER>::diffuse(m, pos);
+    default:             return Shader<T, SHADE_VIRTUAL>::diffuse(m, pos);
+    }
+}
+
+// The materials of a scene as one flat array of MaterialParams, numbered
+// in the order they were first seen.
+template<typename T>
+class MaterialTable
+{
+public:
+    void clear()
+    {
+        m_params.clear();
+        m_ids.clear();
+        m_last = NULL;
+    }
+
+    // id of m, which is added on first sight
+    uint32_t add(const Material<T>* m)
+    {
+        // runs of primitives tend to share their material
+        if (m == m_last)
+            return m_last_id;
+        auto i = m_ids.find(m);
+        if (i == m_ids.end())
+        {
+            i = m_ids.emplace(m, uint32_t(m_params.size())).first;
+            m_params.push_back(m->params());
+        }
+        m_last    = m;
+        m_last_id = i->second;
+        return m_last_id;
+    }
+
+    size_t                   size()                   const { return m_params.size(); }
+    const MaterialParams<T>& operator [] (uint32_t id) const { return m_params[id]; }
+
+private:
+    std::vector<MaterialParams<T>>                   m_params;
+    std::unordered_map<const Material<T>*, uint32_t> m_ids;
+    const Material<T>*                               m_last = NULL;
+    uint32_t                                         m_last_id = 0;
 };
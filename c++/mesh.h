@@ -0,0 +1,273 @@
+#pragma once
+
+#include "objects.h"
+#include "bvh.h"
+#include "stats.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Triangles in compact buffers: three floats per vertex position and three
+// vertex indices per triangle, with the triangles laid out in the order of
+// the mesh's own BVH. Meshes are immutable once built and may be shared by
+// several TriangleMesh objects.
+template <typename T>
+struct MeshData
+{
+    std::vector<T>        positions;        // x, y, z per vertex
+    std::vector<uint32_t> indices;          // three vertices per triangle
+    BVH<T>                bvh;
+    std::string           source;           // file it was loaded from, if any
+
+    size_t triangles() const { return indices.size() / 3; }
+
+    Vec3<T> vertex(unsigned triangle, int k) const
+    {
+        const T* p = &positions[3 * indices[3 * triangle + k]];
+        return { p[0], p[1], p[2] };
+    }
+    AABB<T> bounds(unsigned triangle) const
+    {
+        AABB<T> box;
+        for (int k = 0; k < 3; ++k)
+            box.extend(vertex(triangle, k));
+        return box;
+    }
+    AABB<T> bounds() const
+    {
+        return bvh.nodes().empty() ? AABB<T>() : bvh.nodes()[0].box;
+    }
+
+    // build the BVH over the triangles and lay them out in its order; to
+    // be called once the buffers are filled
+    void build()
+    {
+        std::vector<AABB<T>> boxes(triangles());
+        for (unsigned t = 0; t < boxes.size(); ++t)
+            boxes[t] = bounds(t);
+        bvh.build(boxes);
+        std::vector<uint32_t> ordered;
+        ordered.reserve(indices.size());
+        for (auto t: bvh.order())
+            ordered.insert(ordered.end(), &indices[3 * t], &indices[3 * t] + 3);
+        indices.swap(ordered);
+    }
+};
+
+// Watertight ray / triangle test (Woop, Benthin and Wald, JCGT 2013). The
+// ray is sheared so it runs along +z from the origin; the triangle is then
+// hit if the origin lies inside its 2D projection. Edges shared by two
+// triangles are decided the same way for both, so rays cannot slip through
+// a closed mesh between them.
+template <typename T>
+class WatertightRay
+{
+public:
+    explicit WatertightRay(const Ray<T>& ray) : m_start(ray.start)
+    {
+        Vec3<T> a = { std::abs(ray.dir[0]), std::abs(ray.dir[1]), std::abs(ray.dir[2]) };
+        m_kz = a[0] > a[1] ? (a[0] > a[2] ? 0 : 2) : (a[1] > a[2] ? 1 : 2);
+        m_kx = (m_kz + 1) % 3;
+        m_ky = (m_kx + 1) % 3;
+        // keep the winding of the projection
+        if (ray.dir[m_kz] < 0)
+            std::swap(m_kx, m_ky);
+        m_sx = ray.dir[m_kx] / ray.dir[m_kz];
+        m_sy = ray.dir[m_ky] / ray.dir[m_kz];
+        m_sz = T(1) / ray.dir[m_kz];
+    }
+
+    // true if the triangle is hit closer than *distance, which is updated
+    bool intersect(const T* v0, const T* v1, const T* v2, T* distance) const
+    {
+        T a[3], b[3], c[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            a[i] = v0[i] - m_start[i];
+            b[i] = v1[i] - m_start[i];
+            c[i] = v2[i] - m_start[i];
+        }
+        T ax = a[m_kx] - m_sx * a[m_kz], ay = a[m_ky] - m_sy * a[m_kz];
+        T bx = b[m_kx] - m_sx * b[m_kz], by = b[m_ky] - m_sy * b[m_kz];
+        T cx = c[m_kx] - m_sx * c[m_kz], cy = c[m_ky] - m_sy * c[m_kz];
+
+        // scaled barycentric coordinates, redone in double on an edge
+        T u = cx * by - cy * bx;
+        T v = ax * cy - ay * cx;
+        T w = bx * ay - by * ax;
+        if (u == 0 || v == 0 || w == 0)
+        {
+            u = T(double(cx) * by - double(cy) * bx);
+            v = T(double(ax) * cy - double(ay) * cx);
+            w = T(double(bx) * ay - double(by) * ax);
+        }
+        if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0))
+            return false;
+        T det = u + v + w;
+        if (det == 0)
+            return false;
+
+        // hit distance, still scaled by det
+        T t = u * (m_sz * a[m_kz]) + v * (m_sz * b[m_kz]) + w * (m_sz * c[m_kz]);
+        if (det > 0 ? (t <= 0 || t > *distance * det) : (t >= 0 || t < *distance * det))
+            return false;
+        *distance = t / det;
+        return true;
+    }
+
+private:
+    Vec3<T> m_start;
+    int     m_kx, m_ky, m_kz;
+    T       m_sx, m_sy, m_sz;
+};
+
+// A triangle mesh as one scene object. Rays are intersected through the
+// mesh's own BVH, so the scene BVH sees a single primitive however many
+// triangles there are; faces are flat shaded.
+template <typename T>
+class TriangleMesh : public Object<T>
+{
+public:
+    TriangleMesh(std::shared_ptr<const MeshData<T>> mesh, const Material<T>& m) :
+        m_mesh(std::move(mesh)), m_material(m)
+    {}
+
+    // part is the triangle hit
+    bool intersect(const Ray<T>& ray, T* distance = NULL, unsigned* part = NULL) const
+    {
+        Triangles triangles(*m_mesh, ray);
+        T d;
+        int t = m_mesh->bvh.intersect(triangles, ray, &d);
+        if (t < 0)
+            return false;
+        if (distance)
+            *distance = d;
+        if (part)
+            *part = t;
+        return true;
+    }
+    Vec3<T> normal(const Vec3<T>&, unsigned part = 0) const
+    {
+        auto v0 = m_mesh->vertex(part, 0);
+        return cross(m_mesh->vertex(part, 1) - v0, m_mesh->vertex(part, 2) - v0).normalized();
+    }
+    const Material<T>& material() const
+    {
+        return m_material;
+    }
+    AABB<T> bounds() const
+    {
+        return m_mesh->bounds();
+    }
+    const std::shared_ptr<const MeshData<T>>& mesh() const { return m_mesh; }
+
+private:
+    // the mesh's triangles as seen by one ray, for BVH::intersect()
+    struct Triangles
+    {
+        const MeshData<T>& mesh;
+        WatertightRay<T>   ray;
+
+        Triangles(const MeshData<T>& m, const Ray<T>& r) : mesh(m), ray(r) {}
+
+        bool intersect(unsigned t, const Ray<T>&, T* distance, unsigned* = NULL) const
+        {
+            STAT(triangle_tests++);
+            const uint32_t* i = &mesh.indices[3 * t];
+            return ray.intersect(&mesh.positions[3 * i[0]], &mesh.positions[3 * i[1]],
+                                 &mesh.positions[3 * i[2]], distance);
+        }
+    };
+
+    static Vec3<T> cross(const Vec3<T>& a, const Vec3<T>& b)
+    {
+        return { a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0] };
+    }
+
+    std::shared_ptr<const MeshData<T>> m_mesh;
+    const Material<T>&                 m_material;
+};
+
+// Read the vertices and faces of a Wavefront OBJ file into mesh and build
+// it. Polygons are split into triangle fans; texture coordinates, normals,
+// groups and materials are ignored. Errors are reported with their line.
+template <typename T>
+bool load_obj(const char* path, MeshData<T>& mesh)
+{
+    FILE* f = fopen(path, "r");
+    if (!f)
+    {
+        printf("cannot open %s\n", path);
+        return false;
+    }
+    mesh.positions.clear();
+    mesh.indices.clear();
+    mesh.source = path;
+
+    char     line[4096];
+    unsigned number = 0;
+    bool     ok = true;
+    std::vector<uint32_t> face;
+    while (ok && fgets(line, sizeof(line), f))
+    {
+        ++number;
+        char* p = line;
+        while (*p == ' ' || *p == '\t')
+            ++p;
+        if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+        {
+            p += 2;
+            for (int i = 0; ok && i < 3; ++i)
+            {
+                char* end;
+                mesh.positions.push_back(strtof(p, &end));
+                ok = end != p;
+                p = end;
+            }
+        }
+        else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+        {
+            // v, v/vt, v//vn or v/vt/vn; negative indices count back from
+            // the last vertex
+            long vertices = mesh.positions.size() / 3;
+            face.clear();
+            p += 2;
+            for (;;)
+            {
+                char* end;
+                long i = strtol(p, &end, 10);
+                if (end == p)
+                    break;
+                i = i < 0 ? vertices + i : i - 1;
+                if (i < 0 || i >= vertices)
+                {
+                    ok = false;
+                    break;
+                }
+                face.push_back(uint32_t(i));
+                p = end;
+                while (*p && *p != ' ' && *p != '\t')
+                    ++p;
+            }
+            ok = ok && face.size() >= 3;
+            for (size_t k = 2; ok && k < face.size(); ++k)
+            {
+                mesh.indices.push_back(face[0]);
+                mesh.indices.push_back(face[k - 1]);
+                mesh.indices.push_back(face[k]);
+            }
+        }
+    }
+    fclose(f);
+    if (!ok)
+    {
+        printf("%s:%u: cannot parse\n", path, number);
+        return false;
+    }
+    mesh.build();
+    return true;
+}
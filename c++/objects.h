@@ -2,6 +2,7 @@
 
 #include "vecmat.h"
 #include "material.h"
+#include <limits>
 
 template <typename T>
 struct Ray
@@ -9,11 +10,46 @@ struct Ray
     Vec3<T> start;
     Vec3<T> dir;
 
+    Ray() {}
     Ray(const Vec3<T>& _start, const Vec3<T>& _dir) :
         start(_start), dir(_dir)
     {}
 };
 
+// axis aligned bounding box
+template <typename T>
+struct AABB
+{
+    Vec3<T> lo;
+    Vec3<T> hi;
+
+    AABB() : lo(std::numeric_limits<T>::max()), hi(-std::numeric_limits<T>::max()) {}
+    AABB(const Vec3<T>& _lo, const Vec3<T>& _hi) : lo(_lo), hi(_hi) {}
+
+    void extend(const Vec3<T>& p)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            lo[i] = std::min(lo[i], p[i]);
+            hi[i] = std::max(hi[i], p[i]);
+        }
+    }
+    void extend(const AABB& b)
+    {
+        extend(b.lo);
+        extend(b.hi);
+    }
+    Vec3<T> center() const
+    {
+        return (lo + hi) * T(0.5);
+    }
+    T area() const
+    {
+        auto d = hi - lo;
+        return 2 * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
+    }
+};
+
 template <typename T>
 class Light
 {
@@ -34,9 +70,13 @@ class Object
 {
 public:
     virtual ~Object() {}
-    virtual Vec3<T> normal(const Vec3<T>& pos) const = 0;
-	virtual bool intersect(const Ray<T>& ray, T* distance = NULL) const = 0;
+    // part is the piece of the object a ray hit, for objects made of
+    // several (a mesh's triangle); intersect() reports it and normal() is
+    // handed it back. Simple objects leave it alone.
+    virtual Vec3<T> normal(const Vec3<T>& pos, unsigned part = 0) const = 0;
+	virtual bool intersect(const Ray<T>& ray, T* distance = NULL, unsigned* part = NULL) const = 0;
     virtual const Material<T>& material() const = 0;
+    virtual AABB<T> bounds() const = 0;
 };
 
 template <typename T>
@@ -46,11 +86,11 @@ public:
     Sphere(const Vec3<T> &c, const T &r, const Material<T>& m) :
 		m_center(c), m_radius(r), m_material(m)
 	{}
-    Vec3<T> normal(const Vec3<T>& pos) const
+    Vec3<T> normal(const Vec3<T>& pos, unsigned = 0) const
     {
         return (pos - m_center).normalized();
     }    
-	bool intersect(const Ray<T>& ray, T* distance = NULL) const
+	bool intersect(const Ray<T>& ray, T* distance = NULL, unsigned* = NULL) const
 	{
 		auto l = m_center - ray.start;
 		auto a = l.dot(ray.dir);
@@ -60,7 +100,8 @@ public:
         auto r2 = m_radius * m_radius;
 		if (b2 > r2)            // perpendicular > r
             return false;
-        auto c = sqrt(r2 - b2);
+        // in double, as it always was; the packet kernels do the same
+        auto c = std::sqrt(double(r2 - b2));
         if (distance)
         {
             T near = a - c;
@@ -74,6 +115,13 @@ public:
     {
         return m_material;
     }
+    AABB<T> bounds() const
+    {
+        return { m_center - Vec3<T>(m_radius), m_center + Vec3<T>(m_radius) };
+    }
+    const Vec3<T>& center() const { return m_center; }
+    T              radius() const { return m_radius; }
+    void           move_to(const Vec3<T>& c) { m_center = c; }
 protected:
     Vec3<T>            m_center;
     T                  m_radius;
@@ -0,0 +1,269 @@
+#pragma once
+
+#include "trace.h"
+#include <limits>
+
+// Ray packets for coherent primary rays. The traversal in packet_kernel.h
+// is compiled for SSE (4 lanes), AVX2 (8) and AVX-512 (16); the widest one
+// the CPU supports is picked at runtime.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__SSE2__))
+#define PACKET_SIMD 1
+#include <immintrin.h>
+#endif
+
+template <unsigned N>
+struct RayPacket
+{
+    alignas(64) float ox[N];
+    alignas(64) float oy[N];
+    alignas(64) float oz[N];
+    alignas(64) float dx[N];
+    alignas(64) float dy[N];
+    alignas(64) float dz[N];
+};
+
+#ifdef PACKET_SIMD
+
+namespace packet_sse
+{
+    struct Simd
+    {
+        typedef __m128 F;
+        typedef __m128 M;
+        enum { width = 4 };
+
+        static F load(const float* p)           { return _mm_load_ps(p); }
+        static void store(float* p, F v)        { _mm_store_ps(p, v); }
+        static F set1(float x)                  { return _mm_set1_ps(x); }
+        static F set1i(int x)                   { return _mm_castsi128_ps(_mm_set1_epi32(x)); }
+        static F add(F a, F b)                  { return _mm_add_ps(a, b); }
+        static F sub(F a, F b)                  { return _mm_sub_ps(a, b); }
+        static F mul(F a, F b)                  { return _mm_mul_ps(a, b); }
+        static F div(F a, F b)                  { return _mm_div_ps(a, b); }
+        static F sqrt(F a)                      { return _mm_sqrt_ps(a); }
+        static F min(F a, F b)                  { return _mm_min_ps(a, b); }
+        static F max(F a, F b)                  { return _mm_max_ps(a, b); }
+        static M lt(F a, F b)                   { return _mm_cmplt_ps(a, b); }
+        static M le(F a, F b)                   { return _mm_cmple_ps(a, b); }
+        static M ge(F a, F b)                   { return _mm_cmpge_ps(a, b); }
+        static M mask_and(M a, M b)             { return _mm_and_ps(a, b); }
+        static F select(M m, F a, F b)          { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+        static bool any(M m)                    { return _mm_movemask_ps(m) != 0; }
+        // a -/+ sqrt(d2) worked out in double and rounded, as the scalar
+        // sphere test does
+        static void near_far(F a, F d2, F* near, F* far)
+        {
+            __m128d alo = _mm_cvtps_pd(a), ahi = _mm_cvtps_pd(_mm_movehl_ps(a, a));
+            __m128d clo = _mm_sqrt_pd(_mm_cvtps_pd(d2)), chi = _mm_sqrt_pd(_mm_cvtps_pd(_mm_movehl_ps(d2, d2)));
+            *near = _mm_movelh_ps(_mm_cvtpd_ps(_mm_sub_pd(alo, clo)), _mm_cvtpd_ps(_mm_sub_pd(ahi, chi)));
+            *far  = _mm_movelh_ps(_mm_cvtpd_ps(_mm_add_pd(alo, clo)), _mm_cvtpd_ps(_mm_add_pd(ahi, chi)));
+        }
+    };
+#include "packet_kernel.h"
+}
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+namespace packet_avx2
+{
+    struct Simd
+    {
+        typedef __m256 F;
+        typedef __m256 M;
+        enum { width = 8 };
+
+        static F load(const float* p)           { return _mm256_load_ps(p); }
+        static void store(float* p, F v)        { _mm256_store_ps(p, v); }
+        static F set1(float x)                  { return _mm256_set1_ps(x); }
+        static F set1i(int x)                   { return _mm256_castsi256_ps(_mm256_set1_epi32(x)); }
+        static F add(F a, F b)                  { return _mm256_add_ps(a, b); }
+        static F sub(F a, F b)                  { return _mm256_sub_ps(a, b); }
+        static F mul(F a, F b)                  { return _mm256_mul_ps(a, b); }
+        static F div(F a, F b)                  { return _mm256_div_ps(a, b); }
+        static F sqrt(F a)                      { return _mm256_sqrt_ps(a); }
+        static F min(F a, F b)                  { return _mm256_min_ps(a, b); }
+        static F max(F a, F b)                  { return _mm256_max_ps(a, b); }
+        static M lt(F a, F b)                   { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+        static M le(F a, F b)                   { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+        static M ge(F a, F b)                   { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+        static M mask_and(M a, M b)             { return _mm256_and_ps(a, b); }
+        static F select(M m, F a, F b)          { return _mm256_blendv_ps(b, a, m); }
+        static bool any(M m)                    { return _mm256_movemask_ps(m) != 0; }
+        static void near_far(F a, F d2, F* near, F* far)
+        {
+            __m256d alo = _mm256_cvtps_pd(_mm256_castps256_ps128(a));
+            __m256d ahi = _mm256_cvtps_pd(_mm256_extractf128_ps(a, 1));
+            __m256d clo = _mm256_sqrt_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(d2)));
+            __m256d chi = _mm256_sqrt_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(d2, 1)));
+            *near = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(_mm256_sub_pd(alo, clo))),
+                                         _mm256_cvtpd_ps(_mm256_sub_pd(ahi, chi)), 1);
+            *far  = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(_mm256_add_pd(alo, clo))),
+                                         _mm256_cvtpd_ps(_mm256_add_pd(ahi, chi)), 1);
+        }
+    };
+#include "packet_kernel.h"
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+// AVX-512 implies FMA; keep a * b + c unfused to match the scalar path
+#pragma GCC optimize("fp-contract=off")
+namespace packet_avx512
+{
+    struct Simd
+    {
+        typedef __m512    F;
+        typedef __mmask16 M;
+        enum { width = 16 };
+
+        static F load(const float* p)           { return _mm512_load_ps(p); }
+        static void store(float* p, F v)        { _mm512_store_ps(p, v); }
+        static F set1(float x)                  { return _mm512_set1_ps(x); }
+        static F set1i(int x)                   { return _mm512_castsi512_ps(_mm512_set1_epi32(x)); }
+        static F add(F a, F b)                  { return _mm512_add_ps(a, b); }
+        static F sub(F a, F b)                  { return _mm512_sub_ps(a, b); }
+        static F mul(F a, F b)                  { return _mm512_mul_ps(a, b); }
+        static F div(F a, F b)                  { return _mm512_div_ps(a, b); }
+        static F sqrt(F a)                      { return _mm512_sqrt_ps(a); }
+        static F min(F a, F b)                  { return _mm512_min_ps(a, b); }
+        static F max(F a, F b)                  { return _mm512_max_ps(a, b); }
+        static M lt(F a, F b)                   { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+        static M le(F a, F b)                   { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+        static M ge(F a, F b)                   { return _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ); }
+        static M mask_and(M a, M b)             { return a & b; }
+        static F select(M m, F a, F b)          { return _mm512_mask_blend_ps(m, b, a); }
+        static bool any(M m)                    { return m != 0; }
+        static void near_far(F a, F d2, F* near, F* far)
+        {
+            __m512d alo = _mm512_cvtps_pd(_mm512_castps512_ps256(a));
+            __m512d ahi = _mm512_cvtps_pd(upper(a));
+            __m512d clo = _mm512_sqrt_pd(_mm512_cvtps_pd(_mm512_castps512_ps256(d2)));
+            __m512d chi = _mm512_sqrt_pd(_mm512_cvtps_pd(upper(d2)));
+            *near = join(_mm512_cvtpd_ps(_mm512_sub_pd(alo, clo)), _mm512_cvtpd_ps(_mm512_sub_pd(ahi, chi)));
+            *far  = join(_mm512_cvtpd_ps(_mm512_add_pd(alo, clo)), _mm512_cvtpd_ps(_mm512_add_pd(ahi, chi)));
+        }
+        static __m256 upper(F a)
+        {
+            return _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(a), 1));
+        }
+        static F join(__m256 lo, __m256 hi)
+        {
+            return _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castps_pd(_mm512_castps256_ps512(lo)),
+                                                       _mm256_castps_pd(hi), 1));
+        }
+    };
+#include "packet_kernel.h"
+}
+#pragma GCC pop_options
+
+#endif
+
+// widest packet the CPU can trace, 0 if packets are not available
+inline unsigned packet_width()
+{
+#ifdef PACKET_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return 16;
+    if (__builtin_cpu_supports("avx2"))
+        return 8;
+    return 4;
+#else
+    return 0;
+#endif
+}
+
+// Closest hits for a packet of width lanes, and the part of each
+// primitive hit; returns false if packets of
+// that width (or of this precision) are not supported, in which case the
+// caller traces the rays one at a time. Each supported combination is
+// defined below; any other fails to link instead of tracing nothing.
+template <typename T, unsigned N>
+bool intersect_packet(const Scene<T>& scene, const RayPacket<N>& rays, float* nearest, int* hit,
+                      unsigned* part);
+
+// the kernels are float only
+template <unsigned N>
+inline bool intersect_packet(const Scene<double>&, const RayPacket<N>&, float*, int*, unsigned*)
+{
+    return false;
+}
+
+#ifdef PACKET_SIMD
+template <>
+inline bool intersect_packet(const Scene<float>& scene, const RayPacket<4>& rays, float* nearest, int* hit,
+                             unsigned* part)
+{
+    packet_sse::intersect(scene.bvh, scene.prims, rays, nearest, hit, part);
+    return true;
+}
+template <>
+inline bool intersect_packet(const Scene<float>& scene, const RayPacket<8>& rays, float* nearest, int* hit,
+                             unsigned* part)
+{
+    packet_avx2::intersect(scene.bvh, scene.prims, rays, nearest, hit, part);
+    return true;
+}
+template <>
+inline bool intersect_packet(const Scene<float>& scene, const RayPacket<16>& rays, float* nearest, int* hit,
+                             unsigned* part)
+{
+    packet_avx512::intersect(scene.bvh, scene.prims, rays, nearest, hit, part);
+    return true;
+}
+#else
+template <>
+inline bool intersect_packet(const Scene<float>&, const RayPacket<4>&, float*, int*, unsigned*)  { return false; }
+template <>
+inline bool intersect_packet(const Scene<float>&, const RayPacket<8>&, float*, int*, unsigned*)  { return false; }
+template <>
+inline bool intersect_packet(const Scene<float>&, const RayPacket<16>&, float*, int*, unsigned*) { return false; }
+#endif
+
+// Trace N coherent primary rays: the nearest hits are found as one packet
+// and every hit is then shaded with the single ray path. hits, if given,
+// receives the primitive each ray hit or -1. Returns false if packets of
+// that width are not available.
+template <unsigned N, typename T>
+bool trace_packet(const Scene<T>& scene, const Ray<T>* rays, Vec3<T>* colors, int* hits = NULL)
+{
+    RayPacket<N> packet;
+    alignas(64) float nearest[N];
+    alignas(64) int   hit[N];
+    unsigned          part[N];
+    for (unsigned k = 0; k < N; ++k)
+    {
+        packet.ox[k] = rays[k].start[0];
+        packet.oy[k] = rays[k].start[1];
+        packet.oz[k] = rays[k].start[2];
+        packet.dx[k] = rays[k].dir[0];
+        packet.dy[k] = rays[k].dir[1];
+        packet.dz[k] = rays[k].dir[2];
+        nearest[k]   = std::numeric_limits<float>::max();
+    }
+    if (!intersect_packet(scene, packet, nearest, hit, part))
+        return false;
+    STAT(primary += N);
+    STAT(depth[0] += N);
+
+    for (unsigned k = 0; k < N; ++k)
+        colors[k] = shade(rays[k], hit[k], part[k], T(nearest[k]), scene, 0);
+    if (hits)
+        std::copy(hit, hit + N, hits);
+    return true;
+}
+
+template <typename T>
+bool trace_packet(const Scene<T>& scene, unsigned width, const Ray<T>* rays, Vec3<T>* colors,
+                  int* hits = NULL)
+{
+    switch (width)
+    {
+    case 4:  return trace_packet<4>(scene, rays, colors, hits);
+    case 8:  return trace_packet<8>(scene, rays, colors, hits);
+    case 16: return trace_packet<16>(scene, rays, colors, hits);
+    default: return false;
+    }
+}
@@ -0,0 +1,173 @@
+// Packet closest-hit traversal. No include guard: packet.h includes this
+// once per instruction set, inside a namespace that defines Simd.
+
+enum { W = Simd::width };
+typedef Simd::F F;
+typedef Simd::M M;
+
+struct PacketRays
+{
+    F ox, oy, oz;
+    F dx, dy, dz;
+    F ix, iy, iz;
+};
+
+// ray / box slab test for all lanes over [0, nearest]
+static inline M slab(const AABB<float>& box, const PacketRays& r, F nearest, F* tnear)
+{
+    F ax = Simd::mul(Simd::sub(Simd::set1(box.lo[0]), r.ox), r.ix);
+    F bx = Simd::mul(Simd::sub(Simd::set1(box.hi[0]), r.ox), r.ix);
+    F ay = Simd::mul(Simd::sub(Simd::set1(box.lo[1]), r.oy), r.iy);
+    F by = Simd::mul(Simd::sub(Simd::set1(box.hi[1]), r.oy), r.iy);
+    F az = Simd::mul(Simd::sub(Simd::set1(box.lo[2]), r.oz), r.iz);
+    F bz = Simd::mul(Simd::sub(Simd::set1(box.hi[2]), r.oz), r.iz);
+    F tmin = Simd::max(Simd::max(Simd::set1(0), Simd::min(ax, bx)),
+                       Simd::max(Simd::min(ay, by), Simd::min(az, bz)));
+    F tmax = Simd::min(Simd::min(nearest, Simd::max(ax, bx)),
+                       Simd::min(Simd::max(ay, by), Simd::max(az, bz)));
+    *tnear = tmin;
+    return Simd::le(tmin, tmax);
+}
+
+// smallest entry distance among the lanes in mask
+static inline float min_lane(F t, M mask)
+{
+    alignas(64) float v[W];
+    Simd::store(v, Simd::select(mask, t, Simd::set1(std::numeric_limits<float>::max())));
+    return *std::min_element(v, v + W);
+}
+
+// Same arithmetic as Sphere<T>::intersect, so hits are bit-identical
+// with the single ray path.
+static inline void intersect_sphere(const SphereArray<float>& spheres, unsigned s, unsigned i,
+                                    const PacketRays& r, F* nearest, F* hit)
+{
+    F lx = Simd::sub(Simd::set1(spheres.cx[s]), r.ox);
+    F ly = Simd::sub(Simd::set1(spheres.cy[s]), r.oy);
+    F lz = Simd::sub(Simd::set1(spheres.cz[s]), r.oz);
+    F a  = Simd::add(Simd::add(Simd::mul(lx, r.dx), Simd::mul(ly, r.dy)), Simd::mul(lz, r.dz));
+    F l2 = Simd::add(Simd::add(Simd::mul(lx, lx), Simd::mul(ly, ly)), Simd::mul(lz, lz));
+    F b2 = Simd::sub(l2, Simd::mul(a, a));
+    F r2 = Simd::set1(spheres.r2[s]);
+    STAT(intersection_tests += W);
+    M mask = Simd::mask_and(Simd::ge(a, Simd::set1(0)), Simd::le(b2, r2));
+    if (!Simd::any(mask))
+        return;
+    F near, far;
+    Simd::near_far(a, Simd::max(Simd::sub(r2, b2), Simd::set1(0)), &near, &far);
+    F d    = Simd::select(Simd::lt(near, Simd::set1(0)), far, near);
+    mask = Simd::mask_and(mask, Simd::lt(d, *nearest));
+    *nearest = Simd::select(mask, d, *nearest);
+    *hit     = Simd::select(mask, Simd::set1i(i), *hit);
+}
+
+// Closest hit for every lane of the packet. Lanes whose nearest[] starts
+// negative are inactive and never hit. hit[] receives the primitive slot
+// or -1 and part[] the part of it hit (see Object<T>); a sphere hit after
+// another primitive may leave that one's part behind, which spheres ignore.
+static void intersect(const BVH<float>& bvh, const PrimitiveTable<float>& prims,
+                      const RayPacket<W>& packet, float* nearest_out, int* hit_out, unsigned* part_out)
+{
+    PacketRays r;
+    r.ox = Simd::load(packet.ox);
+    r.oy = Simd::load(packet.oy);
+    r.oz = Simd::load(packet.oz);
+    r.dx = Simd::load(packet.dx);
+    r.dy = Simd::load(packet.dy);
+    r.dz = Simd::load(packet.dz);
+    r.ix = Simd::div(Simd::set1(1), r.dx);
+    r.iy = Simd::div(Simd::set1(1), r.dy);
+    r.iz = Simd::div(Simd::set1(1), r.dz);
+
+    F nearest = Simd::load(nearest_out);
+    F hit     = Simd::set1i(-1);
+    std::fill(part_out, part_out + W, 0u);
+
+    auto& nodes   = bvh.nodes();
+    auto& refs    = prims.refs();
+    auto& spheres = prims.spheres();
+    if (!nodes.empty())
+    {
+        unsigned stack[BVH<float>::stack_size];
+        unsigned top = 0;
+        stack[top++] = 0;
+        while (top)
+        {
+            auto& node = nodes[stack[--top]];
+            if (node.count)
+            {
+                for (unsigned i = node.first; i < node.first + node.count; ++i)
+                {
+                    if (refs[i].type == PRIM_SPHERE)
+                    {
+                        intersect_sphere(spheres, refs[i].index, i, r, &nearest, &hit);
+                        continue;
+                    }
+                    // other primitives fall back to one ray at a time;
+                    // instances first move the whole packet into object space
+                    alignas(64) float n[W];
+                    alignas(64) int   h[W];
+                    Simd::store(n, nearest);
+                    Simd::store(reinterpret_cast<float*>(h), hit);
+                    if (refs[i].type == PRIM_INSTANCE)
+                    {
+                        auto& instance = prims.instances()[refs[i].index];
+                        RayPacket<W> local = packet;
+                        transform_rays(instance.to_object(), local.ox, local.oy, local.oz,
+                                       local.dx, local.dy, local.dz, W);
+                        STAT(intersection_tests += W);
+                        for (unsigned k = 0; k < W; ++k)
+                        {
+                            float d = std::numeric_limits<float>::max();
+                            unsigned p = 0;
+                            if (instance.intersect_local({local.ox[k], local.oy[k], local.oz[k]},
+                                                         {local.dx[k], local.dy[k], local.dz[k]}, &d, &p)
+                                && d < n[k])
+                            {
+                                n[k] = d;
+                                h[k] = i;
+                                part_out[k] = p;
+                            }
+                        }
+                    }
+                    else
+                    {
+                        for (unsigned k = 0; k < W; ++k)
+                        {
+                            Ray<float> ray({packet.ox[k], packet.oy[k], packet.oz[k]},
+                                           {packet.dx[k], packet.dy[k], packet.dz[k]});
+                            float d = std::numeric_limits<float>::max();
+                            unsigned p = 0;
+                            if (prims.intersect(i, ray, &d, &p) && d < n[k])
+                            {
+                                n[k] = d;
+                                h[k] = i;
+                                part_out[k] = p;
+                            }
+                        }
+                    }
+                    nearest = Simd::load(n);
+                    hit     = Simd::load(reinterpret_cast<float*>(h));
+                }
+                continue;
+            }
+            F t0, t1;
+            M m0 = slab(nodes[node.first].box,     r, nearest, &t0);
+            M m1 = slab(nodes[node.first + 1].box, r, nearest, &t1);
+            bool hit0 = Simd::any(m0), hit1 = Simd::any(m1);
+            if (hit0 && hit1)
+            {
+                bool left_first = min_lane(t0, m0) < min_lane(t1, m1);
+                stack[top++] = left_first ? node.first + 1 : node.first;
+                stack[top++] = left_first ? node.first : node.first + 1;
+            }
+            else if (hit0)
+                stack[top++] = node.first;
+            else if (hit1)
+                stack[top++] = node.first + 1;
+        }
+    }
+
+    Simd::store(nearest_out, nearest);
+    Simd::store(reinterpret_cast<float*>(hit_out), hit);
+}
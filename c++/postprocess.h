@@ -0,0 +1,272 @@
+#pragma once
+
+#include "framebuffer.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Display conversion as a pass of its own. The renderer only writes linear
+// values into the Framebuffer; PostProcess turns finished tiles or whole
+// frames into display pixels: exposure scales the values, the tone map
+// brings them into [0, 1], gamma correction reads GammaTable, and the
+// results are packed into 8 bit rgb for image files or into 32 bit words
+// for a display surface, a tile as the renderer finishes it or the whole
+// frame in parallel. Where the CPU has AVX2 the conversion runs 8
+// values at a time, reading the table with gathers, and packing 8 pixels.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__SSE2__))
+#define POSTPROCESS_AVX2 1
+#endif
+
+enum Tonemap
+{
+    TONEMAP_CLAMP,      // values over 1 are white
+    TONEMAP_REINHARD,   // x / (1 + x)
+};
+
+struct PostSettings
+{
+    float   exposure = 1;
+    Tonemap tonemap  = TONEMAP_CLAMP;
+};
+
+// where the channels go in a 32 bit pixel, 0x00RRGGBB by default
+struct PixelFormat
+{
+    unsigned rshift = 16;
+    unsigned gshift = 8;
+    unsigned bshift = 0;
+};
+
+// to_8bit() of a value in [0, 1] without pow. The table is indexed by the
+// bits of the float above the low 15, from 2^-21 (below which everything
+// is 0) to 1. Each entry covers a range of values so narrow that the 8 bit
+// result steps up at most once in it; the entry holds the result at the
+// start of the range in its low 8 bits and, above them, the low 15 bits of
+// the value where it steps up, or 1 << 15 if it does not.
+class GammaTable
+{
+public:
+    enum
+    {
+        base  = 106 << 23,      // 2^-21
+        shift = 15,
+        mask  = (1 << shift) - 1,
+        size  = (21 << (23 - shift)) + 1,
+    };
+
+    static const uint32_t* get()
+    {
+        static GammaTable table;
+        return table.m_entries.data();
+    }
+
+private:
+    std::vector<uint32_t> m_entries;
+
+    static float   from_bits(int32_t b) { float x; memcpy(&x, &b, sizeof(x)); return x; }
+    static int32_t to_bits(float x)     { int32_t b; memcpy(&b, &x, sizeof(b)); return b; }
+
+    GammaTable() : m_entries(size)
+    {
+        // the smallest value that gives each 8 bit result
+        int32_t one = to_bits(1);
+        int32_t first[256];
+        for (int k = 0; k < 256; ++k)
+        {
+            int32_t lo = 0, hi = one;
+            while (lo < hi)
+            {
+                int32_t mid = lo + (hi - lo) / 2;
+                if (to_8bit(from_bits(mid)) >= k)
+                    hi = mid;
+                else
+                    lo = mid + 1;
+            }
+            first[k] = lo;
+        }
+        for (int i = 0; i < size; ++i)
+        {
+            int32_t start = base + (i << shift);
+            int32_t end   = std::min(start + int32_t(mask), one);
+            int v = to_8bit(from_bits(start));
+            uint32_t step = to_8bit(from_bits(end)) > v ? first[v + 1] & mask : mask + 1;
+            m_entries[i] = uint32_t(v) | step << 8;
+        }
+    }
+};
+
+// display value of one linear channel value, see GammaTable
+inline unsigned char display_8bit(float x, float exposure, bool reinhard, const uint32_t* table)
+{
+    x *= exposure;
+    if (reinhard)
+        x = x / (1 + x);
+    // NaN goes to 0
+    x = std::min(std::max(0.f, x), 1.f);
+    int32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    uint32_t entry = table[std::max(bits - int32_t(GammaTable::base), 0) >> GammaTable::shift];
+    return (unsigned char)((entry & 0xff) + ((bits & GammaTable::mask) >= int32_t(entry >> 8)));
+}
+
+// n pixels of 8 bit rgb packed into 32 bit words
+inline void pack_pixels(const unsigned char* rgb, uint32_t* out, size_t n, const PixelFormat& format)
+{
+    for (size_t i = 0; i < n; ++i)
+        out[i] = uint32_t(rgb[3 * i]) << format.rshift | uint32_t(rgb[3 * i + 1]) << format.gshift |
+                 uint32_t(rgb[3 * i + 2]) << format.bshift;
+}
+
+#ifdef POSTPROCESS_AVX2
+#include <immintrin.h>
+#pragma GCC push_options
+#pragma GCC target("avx2")
+namespace postprocess_avx2
+{
+    // display_8bit() of 8 values at a time, the table read with a gather
+    template <bool Reinhard>
+    void convert(const float* in, unsigned char* out, size_t n, float exposure, const uint32_t* table)
+    {
+        const __m256  scale = _mm256_set1_ps(exposure);
+        const __m256  one   = _mm256_set1_ps(1);
+        const __m256  zero  = _mm256_setzero_ps();
+        const __m256i base  = _mm256_set1_epi32(GammaTable::base);
+        const __m256i mask  = _mm256_set1_epi32(GammaTable::mask);
+        const __m256i low8  = _mm256_set1_epi32(0xff);
+        const __m256i ones  = _mm256_set1_epi32(1);
+        // bytes 0-3 of each 128 bit half after packing
+        const __m256i lanes = _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0);
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            __m256 x = _mm256_mul_ps(_mm256_loadu_ps(in + i), scale);
+            if (Reinhard)
+                x = _mm256_div_ps(x, _mm256_add_ps(one, x));
+            // max_ps returns its second operand for NaN
+            x = _mm256_min_ps(_mm256_max_ps(x, zero), one);
+            __m256i bits  = _mm256_castps_si256(x);
+            __m256i index = _mm256_srli_epi32(_mm256_max_epi32(_mm256_sub_epi32(bits, base),
+                                                               _mm256_setzero_si256()), GammaTable::shift);
+            __m256i entry = _mm256_i32gather_epi32(reinterpret_cast<const int*>(table), index, 4);
+            __m256i value = _mm256_and_si256(entry, low8);
+            // low bits >= step, as low bits > step - 1; true is -1
+            __m256i up = _mm256_cmpgt_epi32(_mm256_and_si256(bits, mask),
+                                            _mm256_sub_epi32(_mm256_srli_epi32(entry, 8), ones));
+            value = _mm256_sub_epi32(value, up);
+            value = _mm256_packus_epi16(_mm256_packus_epi32(value, value), value);
+            value = _mm256_permutevar8x32_epi32(value, lanes);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i), _mm256_castsi256_si128(value));
+        }
+        for (; i < n; ++i)
+            out[i] = display_8bit(in[i], exposure, Reinhard, table);
+    }
+
+    // pack_pixels() of 8 pixels at a time: each 128 bit half takes 4 rgb
+    // triples, whose channels are spread into the low bytes of 4 words,
+    // shifted into place and or-ed together
+    inline void pack(const unsigned char* rgb, uint32_t* out, size_t n, const PixelFormat& format)
+    {
+        // word j takes byte 3 * j + channel into its low byte and zeros above
+        const __m256i r = _mm256_setr_epi32(0xffffff00, 0xffffff03, 0xffffff06, 0xffffff09,
+                                            0xffffff00, 0xffffff03, 0xffffff06, 0xffffff09);
+        const __m256i g = _mm256_add_epi32(r, _mm256_set1_epi32(1));
+        const __m256i b = _mm256_add_epi32(r, _mm256_set1_epi32(2));
+        const __m128i rshift = _mm_cvtsi32_si128(format.rshift);
+        const __m128i gshift = _mm_cvtsi32_si128(format.gshift);
+        const __m128i bshift = _mm_cvtsi32_si128(format.bshift);
+        size_t i = 0;
+        // the second load reads 16 bytes from pixel i + 4
+        for (; 3 * i + 28 <= 3 * n; i += 8)
+        {
+            __m256i v = _mm256_inserti128_si256(
+                _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rgb + 3 * i))),
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgb + 3 * i + 12)), 1);
+            __m256i p = _mm256_or_si256(_mm256_sll_epi32(_mm256_shuffle_epi8(v, r), rshift),
+                        _mm256_or_si256(_mm256_sll_epi32(_mm256_shuffle_epi8(v, g), gshift),
+                                        _mm256_sll_epi32(_mm256_shuffle_epi8(v, b), bshift)));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), p);
+        }
+        pack_pixels(rgb + 3 * i, out + i, n - i, format);
+    }
+}
+#pragma GCC pop_options
+#endif
+
+class PostProcess
+{
+public:
+    explicit PostProcess(const PostSettings& settings = PostSettings(), const PixelFormat& format = PixelFormat()) :
+        m_settings(settings), m_format(format), m_table(GammaTable::get()), m_avx2(false)
+    {
+#ifdef POSTPROCESS_AVX2
+        __builtin_cpu_init();
+        m_avx2 = __builtin_cpu_supports("avx2");
+#endif
+    }
+
+    const PostSettings& settings() const { return m_settings; }
+
+    // 8 bit display values of n linear channel values
+    void convert(const float* in, unsigned char* out, size_t n) const
+    {
+        bool reinhard = m_settings.tonemap == TONEMAP_REINHARD;
+#ifdef POSTPROCESS_AVX2
+        if (m_avx2)
+        {
+            if (reinhard)
+                postprocess_avx2::convert<true>(in, out, n, m_settings.exposure, m_table);
+            else
+                postprocess_avx2::convert<false>(in, out, n, m_settings.exposure, m_table);
+            return;
+        }
+#endif
+        for (size_t i = 0; i < n; ++i)
+            out[i] = display_8bit(in[i], m_settings.exposure, reinhard, m_table);
+    }
+
+    // Pack the rectangle [x0, x1) x [y0, y1) of the framebuffer into the 32
+    // bit pixels of an image of the same size whose rows are pitch bytes
+    // apart; parts of the image outside the rectangle are left alone.
+    void pack(const Framebuffer& fb, void* pixels, size_t pitch,
+              unsigned x0, unsigned y0, unsigned x1, unsigned y1) const
+    {
+        const unsigned chunk = 256;
+        unsigned char rgb[3 * chunk];
+        for (unsigned y = y0; y < y1; ++y)
+        {
+            auto row = reinterpret_cast<uint32_t*>(static_cast<unsigned char*>(pixels) + y * pitch);
+            for (unsigned x = x0; x < x1; x += chunk)
+            {
+                unsigned n = std::min(chunk, x1 - x);
+                convert(fb.pixel(x, y), rgb, 3 * n);
+#ifdef POSTPROCESS_AVX2
+                if (m_avx2)
+                {
+                    postprocess_avx2::pack(rgb, row + x, n, m_format);
+                    continue;
+                }
+#endif
+                pack_pixels(rgb, row + x, n, m_format);
+            }
+        }
+    }
+
+    // The whole frame over the pool's workers, a band of rows at a time;
+    // full rows keep the reads streaming, where square tiles of a wide
+    // frame run about half as fast.
+    void pack(const Framebuffer& fb, void* pixels, size_t pitch, ThreadPool& pool, unsigned rows = 16) const
+    {
+        pool.run((fb.height + rows - 1) / rows, [&] (unsigned t, unsigned) {
+            pack(fb, pixels, pitch, 0, t * rows, fb.width, std::min(t * rows + rows, fb.height));
+        });
+    }
+
+private:
+    PostSettings    m_settings;
+    PixelFormat     m_format;
+    const uint32_t* m_table;
+    bool            m_avx2;
+};
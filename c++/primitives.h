@@ -0,0 +1,186 @@
+#pragma once
+
+#include "objects.h"
+#include "instance.h"
+#include "stats.h"
+#include <vector>
+#include <list>
+
+// Flattened, render-time form of the scene. Every primitive is a compact
+// type tag plus an index into the array for its type; spheres are stored
+// as structure of arrays. Intersection, normal and material lookups switch
+// on the tag instead of going through Object<T>'s virtual interface, which
+// remains the fallback for any other kind of object. Instances get their
+// own tag so packets can move all their rays into object space at once.
+// Spheres and instances are copied into the table, so traversal walks
+// them in BVH order however the scene allocated them. Materials are
+// gathered into a MaterialTable and referred to by id.
+enum PrimitiveType
+{
+    PRIM_SPHERE,
+    PRIM_INSTANCE,
+    PRIM_OBJECT,
+};
+
+struct PrimitiveRef
+{
+    unsigned type  : 4;
+    unsigned index : 28;
+};
+
+template <typename T>
+struct SphereArray
+{
+    std::vector<T>                  cx, cy, cz;
+    std::vector<T>                  radius, r2;
+    std::vector<const Material<T>*> material;
+
+    size_t size() const { return radius.size(); }
+
+    void clear()
+    {
+        cx.clear(); cy.clear(); cz.clear();
+        radius.clear(); r2.clear();
+        material.clear();
+    }
+    void push_back(const Vec3<T>& c, T r, const Material<T>* m)
+    {
+        cx.push_back(c[0]);
+        cy.push_back(c[1]);
+        cz.push_back(c[2]);
+        radius.push_back(r);
+        r2.push_back(r * r);
+        material.push_back(m);
+    }
+    void push_back(const Sphere<T>& s)
+    {
+        push_back(s.center(), s.radius(), &s.material());
+    }
+    Vec3<T> center(unsigned i) const
+    {
+        return { cx[i], cy[i], cz[i] };
+    }
+
+    // same test as Sphere<T>::intersect
+    bool intersect(unsigned i, const Ray<T>& ray, T* distance = NULL) const
+    {
+        Vec3<T> l = { cx[i] - ray.start[0], cy[i] - ray.start[1], cz[i] - ray.start[2] };
+        auto a = l.dot(ray.dir);
+        if (a < 0)              // opposite direction
+            return false;
+        auto b2 = l.dot(l) - a * a;
+        if (b2 > r2[i])         // perpendicular > r
+            return false;
+        auto c = std::sqrt(double(r2[i] - b2));
+        if (distance)
+        {
+            T near = a - c;
+            T far  = a + c;
+            // near < 0 means ray starts inside
+            *distance = (near < 0) ? far : near;
+        }
+        return true;
+    }
+};
+
+template <typename T>
+class PrimitiveTable
+{
+public:
+    // Flatten objects and then spheres, storing primitive order[i] in
+    // slot i; indices past the objects refer to the spheres.
+    void build(const std::vector<const Object<T>*>& objects, const SphereArray<T>& spheres,
+               const std::vector<unsigned>& order)
+    {
+        m_refs.clear();
+        m_spheres.clear();
+        m_instances.clear();
+        m_objects.clear();
+        m_materials.clear();
+        m_material_ids.clear();
+        m_refs.reserve(order.size());
+        m_material_ids.reserve(order.size());
+        for (auto i: order)
+        {
+            PrimitiveRef ref;
+            if (i >= objects.size())
+            {
+                unsigned j = i - objects.size();
+                ref.type  = PRIM_SPHERE;
+                ref.index = m_spheres.size();
+                m_spheres.push_back(spheres.center(j), spheres.radius[j], spheres.material[j]);
+            }
+            else if (auto s = dynamic_cast<const Sphere<T>*>(objects[i]))
+            {
+                ref.type  = PRIM_SPHERE;
+                ref.index = m_spheres.size();
+                m_spheres.push_back(*s);
+            }
+            else if (auto s = dynamic_cast<const Instance<T>*>(objects[i]))
+            {
+                ref.type  = PRIM_INSTANCE;
+                ref.index = m_instances.size();
+                m_instances.push_back(*s);
+            }
+            else
+            {
+                ref.type  = PRIM_OBJECT;
+                ref.index = m_objects.size();
+                m_objects.push_back(objects[i]);
+            }
+            m_refs.push_back(ref);
+            m_material_ids.push_back(m_materials.add(&material_of(ref)));
+        }
+    }
+
+    size_t size() const { return m_refs.size(); }
+
+    // part as for Object<T>
+    bool intersect(unsigned prim, const Ray<T>& ray, T* distance = NULL, unsigned* part = NULL) const
+    {
+        STAT(intersection_tests++);
+        PrimitiveRef ref = m_refs[prim];
+        switch (ref.type)
+        {
+        case PRIM_SPHERE:   return m_spheres.intersect(ref.index, ray, distance);
+        case PRIM_INSTANCE: return m_instances[ref.index].intersect(ray, distance, part);
+        default:            return m_objects[ref.index]->intersect(ray, distance, part);
+        }
+    }
+    Vec3<T> normal(unsigned prim, const Vec3<T>& pos, unsigned part = 0) const
+    {
+        PrimitiveRef ref = m_refs[prim];
+        switch (ref.type)
+        {
+        case PRIM_SPHERE:   return (pos - m_spheres.center(ref.index)).normalized();
+        case PRIM_INSTANCE: return m_instances[ref.index].normal(pos, part);
+        default:            return m_objects[ref.index]->normal(pos, part);
+        }
+    }
+    uint32_t                 material_id(unsigned prim) const { return m_material_ids[prim]; }
+    const MaterialParams<T>& material(unsigned prim)    const { return m_materials[m_material_ids[prim]]; }
+
+    const std::vector<PrimitiveRef>&        refs()      const { return m_refs; }
+    const SphereArray<T>&                   spheres()   const { return m_spheres; }
+    const std::vector<Instance<T>>&         instances() const { return m_instances; }
+    const std::vector<const Object<T>*>&    objects()   const { return m_objects; }
+    const MaterialTable<T>&                 materials() const { return m_materials; }
+
+private:
+    const Material<T>& material_of(PrimitiveRef ref) const
+    {
+        switch (ref.type)
+        {
+        case PRIM_SPHERE:   return *m_spheres.material[ref.index];
+        case PRIM_INSTANCE: return m_instances[ref.index].material();
+        default:            return m_objects[ref.index]->material();
+        }
+    }
+
+    std::vector<PrimitiveRef>       m_refs;
+    SphereArray<T>                  m_spheres;
+    std::vector<Instance<T>>        m_instances;
+    std::vector<const Object<T>*>   m_objects;
+    MaterialTable<T>                m_materials;
+    std::vector<uint32_t>           m_material_ids;     // per slot
+};
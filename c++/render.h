@@ -0,0 +1,207 @@
+#pragma once
+
+#include "trace.h"
+#include "packet.h"
+#include "wavefront.h"
+#include "framebuffer.h"
+#include "scheduler.h"
+#include <atomic>
+#include <functional>
+
+const static float fov = 45;
+const static float pi  = 3.1415926536;
+
+struct RenderSettings
+{
+    unsigned tile_size = 32;
+    unsigned packet    = packet_width();    // rays per primary packet, 0 for none
+    bool     wavefront = false;             // trace tiles breadth first, see wavefront.h
+    unsigned samples   = 1;                 // adaptive antialiasing up to samples^2 per pixel
+    float    contrast  = 0.1f;              // channel difference that triggers it
+    unsigned step      = 1;                 // preview: one ray per step x step block
+
+    // The framebuffer may hold just a window of a larger frame: the camera
+    // covers frame_width x frame_height (0 for the framebuffer's size) and
+    // framebuffer pixel (0, 0) is frame pixel (window_x, window_y).
+    unsigned frame_width  = 0;
+    unsigned frame_height = 0;
+    unsigned window_x     = 0;
+    unsigned window_y     = 0;
+};
+
+// Called from the worker threads as each tile of the frame is finished,
+// with the tile's pixel bounds. Returning false abandons the rest of the
+// frame.
+typedef std::function<bool(unsigned x0, unsigned y0, unsigned x1, unsigned y1)> TileDone;
+
+template <typename T>
+void render(const Scene<T>& scene, Framebuffer& fb, ThreadPool& pool, const RenderSettings& settings,
+            const TileDone& done = TileDone())
+{
+    const unsigned width  = fb.width;
+    const unsigned height = fb.height;
+    const unsigned tile_size = settings.tile_size;
+    const unsigned packet    = settings.packet;
+
+    const unsigned frame_width  = settings.frame_width  ? settings.frame_width  : width;
+    const unsigned frame_height = settings.frame_height ? settings.frame_height : height;
+
+    // eye at [0, 0, 0]
+    // screen plane at [x, y, -1]
+    Vec3<T> eye(0);
+    T h = tan(fov / 360 * 2 * pi / 2) * 2;
+    T w = h * frame_width / frame_height;
+
+    // camera ray through framebuffer pixel x, y, offset by a fraction of a
+    // pixel; the window offset goes in before the fraction so windows see
+    // the same rays as the whole frame
+    auto primary = [&] (unsigned px, unsigned py, T fx = 0, T fy = 0) {
+        T x = T(px + settings.window_x) + fx;
+        T y = T(py + settings.window_y) + fy;
+        Vec3<T> direction = {(T(x) - frame_width / 2) / frame_width  * w,
+                             (T(frame_height)/2 - y) / frame_height * h,
+                             -1.0f };
+        direction.normalize();
+        return Ray<T>(eye, direction);
+    };
+    // primitive seen by each pixel's center, kept for antialiasing
+    bool refine = settings.samples > 1 && settings.step == 1;
+    std::vector<int> ids(refine ? size_t(width) * height : 0);
+    auto put_pixel = [&] (unsigned x, unsigned y, const Vec3<T>& pixel, int hit) {
+        fb.set(x, y, pixel);
+        if (!ids.empty())
+            ids[size_t(y) * width + x] = hit;
+    };
+
+    // packets cover 2x2, 4x2 or 4x4 pixel blocks
+    unsigned block_w = packet == 4 ? 2 : 4;
+    unsigned block_h = packet ? packet / block_w : 1;
+
+    // split the frame into tiles and let the pool spread them over its workers
+    unsigned tiles_x = (width  + tile_size - 1) / tile_size;
+    unsigned tiles_y = (height + tile_size - 1) / tile_size;
+    std::atomic<bool> abandoned(false);
+    typedef std::function<void(unsigned, unsigned, unsigned, unsigned, unsigned)> Tile;
+    auto run_tiles = [&] (const Tile& tile) {
+        pool.run(tiles_x * tiles_y, [&] (unsigned t, unsigned worker) {
+            if (abandoned)
+                return;
+            unsigned x0 = t % tiles_x * tile_size;
+            unsigned y0 = t / tiles_x * tile_size;
+            unsigned x1 = std::min(x0 + tile_size, width);
+            unsigned y1 = std::min(y0 + tile_size, height);
+            tile(x0, y0, x1, y1, worker);
+            if (done && !done(x0, y0, x1, y1))
+                abandoned = true;
+        });
+    };
+
+    std::vector<Wavefront<T>> wavefronts(settings.wavefront ? pool.size() : 0);
+    run_tiles([&] (unsigned x0, unsigned y0, unsigned x1, unsigned y1, unsigned worker) {
+        if (settings.step > 1)
+        {
+            // coarse preview, each traced pixel fills its block
+            const unsigned step = settings.step;
+            for (unsigned by = y0; by < y1; by += step)
+                for (unsigned bx = x0; bx < x1; bx += step)
+                {
+                    auto color = trace(primary(bx, by), scene, 0);
+                    for (unsigned y = by; y < std::min(by + step, y1); ++y)
+                        for (unsigned x = bx; x < std::min(bx + step, x1); ++x)
+                            fb.set(x, y, color);
+                }
+            return;
+        }
+        if (settings.wavefront)
+        {
+            // the whole tile is one wavefront
+            std::vector<Ray<T>>  rays;
+            std::vector<Vec3<T>> colors;
+            std::vector<int>     hits;
+            rays.reserve((x1 - x0) * (y1 - y0));
+            for (unsigned y = y0; y < y1; ++y)
+                for (unsigned x = x0; x < x1; ++x)
+                    rays.push_back(primary(x, y));
+            wavefronts[worker].trace(scene, packet, rays, colors, &hits);
+            for (unsigned y = y0, i = 0; y < y1; ++y)
+                for (unsigned x = x0; x < x1; ++x, ++i)
+                    put_pixel(x, y, colors[i], hits[i]);
+            return;
+        }
+        for (unsigned by = y0; by < y1; by += block_h)
+        {
+            for (unsigned bx = x0; bx < x1; bx += block_w)
+            {
+                unsigned ex = std::min(bx + block_w, x1);
+                unsigned ey = std::min(by + block_h, y1);
+                if (packet && ex - bx == block_w && ey - by == block_h)
+                {
+                    Ray<T>  rays[16];
+                    Vec3<T> colors[16];
+                    int     hits[16];
+                    for (unsigned k = 0; k < packet; ++k)
+                        rays[k] = primary(bx + k % block_w, by + k / block_w);
+                    if (trace_packet(scene, packet, rays, colors, hits))
+                    {
+                        for (unsigned k = 0; k < packet; ++k)
+                            put_pixel(bx + k % block_w, by + k / block_w, colors[k], hits[k]);
+                        continue;
+                    }
+                }
+                // partial blocks and unsupported packets go one ray at a time
+                for (unsigned y = by; y < ey; ++y)
+                    for (unsigned x = bx; x < ex; ++x)
+                    {
+                        int hit;
+                        auto color = trace(primary(x, y), scene, 0, &hit);
+                        put_pixel(x, y, color, hit);
+                    }
+            }
+        }
+    });
+
+    if (!refine || abandoned)
+        return;
+
+    // Adaptive antialiasing: pixels that differ from a neighbour by more
+    // than the contrast threshold in any channel, or see another primitive,
+    // are traced again with a samples x samples grid and averaged. The
+    // tests read the one sample image so the result does not depend on
+    // the order tiles are refined in.
+    const Framebuffer first = fb;
+    const unsigned n = settings.samples;
+    auto differs = [&] (unsigned x0, unsigned y0, unsigned x1, unsigned y1) {
+        if (ids[size_t(y0) * width + x0] != ids[size_t(y1) * width + x1])
+            return true;
+        const float* a = first.pixel(x0, y0);
+        const float* b = first.pixel(x1, y1);
+        for (int i = 0; i < 3; ++i)
+            if (std::abs(a[i] - b[i]) > settings.contrast)
+                return true;
+        return false;
+    };
+    run_tiles([&] (unsigned x0, unsigned y0, unsigned x1, unsigned y1, unsigned) {
+        std::vector<Ray<T>>  rays(n * n);
+        std::vector<Vec3<T>> colors(n * n);
+        for (unsigned y = y0; y < y1; ++y)
+        {
+            for (unsigned x = x0; x < x1; ++x)
+            {
+                if (!((x > 0          && differs(x, y, x - 1, y)) ||
+                      (x + 1 < width  && differs(x, y, x + 1, y)) ||
+                      (y > 0          && differs(x, y, x, y - 1)) ||
+                      (y + 1 < height && differs(x, y, x, y + 1))))
+                    continue;
+                for (unsigned k = 0; k < n * n; ++k)
+                    rays[k] = primary(x, y, T(k % n) / n, T(k / n) / n);
+                if (!trace_packet(scene, n * n, &rays[0], &colors[0]))
+                    for (unsigned k = 0; k < n * n; ++k)
+                        colors[k] = trace(rays[k], scene, 0);
+                Vec3<T> sum(0);
+                for (auto& c: colors)
+                    sum += c;
+                fb.set(x, y, sum * (T(1) / (n * n)));
+            }
+        }
+    });
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "objects.h"
+#include "bvh.h"
+#include "primitives.h"
+#include "arena.h"
+#include <type_traits>
+#include <vector>
+
+// ~Sphere has nothing to do, so arenas need not call it
+template <typename T>
+struct ArenaTrivial<Sphere<T>> : std::true_type {};
+
+template <typename T>
+struct Scene
+{
+    Arena                   arena;              // holds everything add()ed, see below
+    std::vector<Object<T>*> objects;
+    std::vector<Light<T>*>  lights;
+    SphereArray<T>          spheres;            // more spheres, as loaded from scene files
+    BVH<T>                  bvh;
+    PrimitiveTable<T>       prims;
+    unsigned                max_depth = 6;      // reflection / refraction bounces
+    T                       min_weight = 0;     // secondary rays contributing less are cut off
+    bool                    roulette = false;   // ... or kept with russian roulette
+
+    // Move an object, light or material into the scene's arena, where
+    // things added one after another lie next to each other, and return
+    // where it now lives. Objects and lights are also put in their lists.
+    // Everything goes at once with the scene.
+    template <typename U>
+    typename std::decay<U>::type* add(U&& u)
+    {
+        auto p = arena.make<typename std::decay<U>::type>(std::forward<U>(u));
+        enlist(p);
+        return p;
+    }
+
+    // flatten the objects and spheres into the primitive table, laid out
+    // in BVH order; must be called after objects are added or moved
+    void build()
+    {
+        std::vector<const Object<T>*> flat(objects.begin(), objects.end());
+        std::vector<AABB<T>> boxes;
+        bounds(flat, boxes);
+        bvh.build(boxes);
+        prims.build(flat, spheres, bvh.order());
+    }
+
+    // Cheaper build() for when objects moved but none were added or
+    // removed: the BVH is refitted to the new bounds, and only rebuilt once
+    // that has grown its nodes by more than rebuild_ratio (see
+    // BVH::degradation()). Returns true if it was rebuilt.
+    bool update(T rebuild_ratio = T(1.25))
+    {
+        std::vector<const Object<T>*> flat(objects.begin(), objects.end());
+        std::vector<AABB<T>> boxes;
+        bounds(flat, boxes);
+        bvh.refit(boxes);
+        bool rebuild = bvh.degradation() > rebuild_ratio;
+        if (rebuild)
+            bvh.build(boxes);
+        prims.build(flat, spheres, bvh.order());
+        return rebuild;
+    }
+
+    // primitive nearest along the ray, or -1, and the part of it hit
+    int intersect(const Ray<T>& ray, T* distance, unsigned* part = NULL) const
+    {
+        return bvh.intersect(prims, ray, distance, part);
+    }
+    // true if a primitive lies on the ray closer than distance. *last is
+    // the slot that blocked the previous ray of this kind, which is likely
+    // to block this one too and is tested before the BVH. It is replaced by
+    // the occluder found, or -1 so unshadowed runs skip the extra test.
+    bool occluded(const Ray<T>& ray, T distance, int* last) const
+    {
+        if (*last >= 0 && unsigned(*last) < prims.size())
+        {
+            T d;
+            STAT(shadow_tests++);
+            if (prims.intersect(*last, ray, &d) && d < distance)
+            {
+                STAT(occluder_hits++);
+                return true;
+            }
+        }
+        *last = bvh.occluder(prims, ray, distance);
+        return *last >= 0;
+    }
+
+private:
+    void enlist(Object<T>* o)         { objects.push_back(o); }
+    void enlist(Light<T>* l)          { lights.push_back(l); }
+    void enlist(const Material<T>*)   {}
+
+    // boxes of the objects followed by the spheres
+    void bounds(const std::vector<const Object<T>*>& flat, std::vector<AABB<T>>& boxes) const
+    {
+        boxes.reserve(flat.size() + spheres.size());
+        for (auto& o: flat)
+            boxes.push_back(o->bounds());
+        for (size_t i = 0; i < spheres.size(); ++i)
+        {
+            Vec3<T> r(spheres.radius[i]);
+            boxes.push_back({ spheres.center(i) - r, spheres.center(i) + r });
+        }
+    }
+};
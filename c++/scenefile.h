@@ -0,0 +1,563 @@
+#pragma once
+
+#include "scene.h"
+#include "mesh.h"
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Scene files come in two forms with the same content. The text form is
+// line based and meant for editing:
+//
+//   # comment
+//   material floor checker diffuse 1 1 1 reflection .1
+//   material glass diffuse .1 .2 .1 reflection .1 transparency .7 ior 1.4
+//   light -10 20 30  2 2 2
+//   sphere 0 -10002 -20  10000  floor
+//   mesh bunny.obj glass
+//
+// Materials are defined before the spheres and meshes that name them; mesh
+// files are OBJ, found relative to the scene file. The binary form is a
+// SceneHeader followed by the material table, the lights, the meshes and
+// the spheres as flat arrays of centers, radii and material indices, each
+// section 64 byte aligned. It is mapped into memory and copied into the
+// scene array by array, with no parsing and no allocation per object.
+
+struct SceneHeader
+{
+    char     magic[8];              // "RTSCENE"
+    uint32_t version;
+    uint32_t materials;
+    uint32_t lights;
+    uint32_t meshes;
+    uint64_t spheres;
+};
+
+struct MaterialRecord
+{
+    float    diffuse[3];
+    float    reflection;
+    float    transparency;
+    float    ior;
+    uint32_t checker;               // diffuse alternates with black
+    uint32_t reserved;
+};
+
+struct LightRecord
+{
+    float    position[3];
+    float    color[3];
+};
+
+struct MeshRecord
+{
+    char     path[252];             // OBJ file, nul terminated
+    uint32_t material;
+};
+
+// byte offsets of the sections of a binary scene
+struct SceneLayout
+{
+    uint64_t materials, lights, meshes, cx, cy, cz, radius, material, size;
+
+    explicit SceneLayout(const SceneHeader& h)
+    {
+        uint64_t n = h.spheres;
+        materials = align(sizeof(SceneHeader));
+        lights    = align(materials + h.materials * sizeof(MaterialRecord));
+        meshes    = align(lights + h.lights * sizeof(LightRecord));
+        cx        = align(meshes + h.meshes * sizeof(MeshRecord));
+        cy        = align(cx + n * sizeof(float));
+        cz        = align(cy + n * sizeof(float));
+        radius    = align(cz + n * sizeof(float));
+        material  = align(radius + n * sizeof(float));
+        size      = material + n * sizeof(uint32_t);
+    }
+    static uint64_t align(uint64_t offset) { return (offset + 63) & ~uint64_t(63); }
+};
+
+static const char     scene_magic[8] = "RTSCENE";
+static const uint32_t scene_version  = 1;
+
+// Scene file content as flat arrays, pointing into a mapped binary file
+// or into a SceneData.
+struct SceneView
+{
+    size_t                materials = 0;
+    size_t                lights    = 0;
+    size_t                meshes    = 0;
+    size_t                spheres   = 0;
+    const MaterialRecord* material  = NULL;
+    const LightRecord*    light     = NULL;
+    const MeshRecord*     mesh      = NULL;
+    const float*          cx        = NULL;
+    const float*          cy        = NULL;
+    const float*          cz        = NULL;
+    const float*          radius    = NULL;
+    const uint32_t*       sphere_material = NULL;
+};
+
+// Scene file content held in memory, as read from text or described from
+// a scene.
+struct SceneData
+{
+    std::vector<MaterialRecord> materials;
+    std::vector<LightRecord>    lights;
+    std::vector<MeshRecord>     meshes;
+    std::vector<float>          cx, cy, cz, radius;
+    std::vector<uint32_t>       material;
+
+    SceneView view() const
+    {
+        SceneView v;
+        v.materials       = materials.size();
+        v.lights          = lights.size();
+        v.meshes          = meshes.size();
+        v.spheres         = radius.size();
+        v.material        = materials.data();
+        v.light           = lights.data();
+        v.mesh            = meshes.data();
+        v.cx              = cx.data();
+        v.cy              = cy.data();
+        v.cz              = cz.data();
+        v.radius          = radius.data();
+        v.sphere_material = material.data();
+        return v;
+    }
+};
+
+// Read-only view of a whole file; memory mapped where the platform has
+// mmap, read into memory otherwise.
+class MappedFile
+{
+public:
+    explicit MappedFile(const char* path) : m_data(NULL), m_size(0)
+    {
+#ifndef _WIN32
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED)
+            {
+                m_data = static_cast<const unsigned char*>(p);
+                m_size = st.st_size;
+            }
+        }
+        close(fd);
+#else
+        FILE* f = fopen(path, "rb");
+        if (!f)
+            return;
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        if (size > 0)
+        {
+            m_copy.resize(size);
+            if (fread(&m_copy[0], 1, size, f) == size_t(size))
+            {
+                m_data = &m_copy[0];
+                m_size = size;
+            }
+        }
+        fclose(f);
+#endif
+    }
+    ~MappedFile()
+    {
+#ifndef _WIN32
+        if (m_data)
+            munmap(const_cast<unsigned char*>(m_data), m_size);
+#endif
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator = (const MappedFile&) = delete;
+
+    const unsigned char* data() const { return m_data; }
+    size_t               size() const { return m_size; }
+
+private:
+    const unsigned char*       m_data;
+    size_t                     m_size;
+#ifdef _WIN32
+    std::vector<unsigned char> m_copy;
+#endif
+};
+
+inline bool is_binary_scene(const unsigned char* data, size_t size)
+{
+    return size >= sizeof(SceneHeader) && !memcmp(data, scene_magic, sizeof(scene_magic));
+}
+inline bool is_binary_scene(const MappedFile& file)
+{
+    return is_binary_scene(file.data(), file.size());
+}
+
+// point view at the sections of a binary scene in memory
+inline bool map_binary_scene(const unsigned char* p, size_t size, SceneView& view)
+{
+    if (!is_binary_scene(p, size))
+        return false;
+    SceneHeader h;
+    memcpy(&h, p, sizeof(h));
+    // no count can be larger than the file has bytes for, which also keeps
+    // the offsets of SceneLayout from wrapping
+    uint64_t bytes = size - sizeof(SceneHeader);
+    if (h.version != scene_version ||
+        h.materials > bytes / sizeof(MaterialRecord) ||
+        h.lights    > bytes / sizeof(LightRecord) ||
+        h.meshes    > bytes / sizeof(MeshRecord) ||
+        h.spheres   > bytes / (4 * sizeof(float) + sizeof(uint32_t)))
+        return false;
+    SceneLayout layout(h);
+    if (layout.size > size)
+        return false;
+
+    view.materials       = h.materials;
+    view.lights          = h.lights;
+    view.meshes          = h.meshes;
+    view.spheres         = h.spheres;
+    view.material        = reinterpret_cast<const MaterialRecord*>(p + layout.materials);
+    view.light           = reinterpret_cast<const LightRecord*>(p + layout.lights);
+    view.mesh            = reinterpret_cast<const MeshRecord*>(p + layout.meshes);
+    view.cx              = reinterpret_cast<const float*>(p + layout.cx);
+    view.cy              = reinterpret_cast<const float*>(p + layout.cy);
+    view.cz              = reinterpret_cast<const float*>(p + layout.cz);
+    view.radius          = reinterpret_cast<const float*>(p + layout.radius);
+    view.sphere_material = reinterpret_cast<const uint32_t*>(p + layout.material);
+    return true;
+}
+inline bool map_binary_scene(const MappedFile& file, SceneView& view)
+{
+    return map_binary_scene(file.data(), file.size(), view);
+}
+
+// parse the text form; errors are reported with their line number
+inline bool read_text_scene(const char* path, SceneData& data)
+{
+    FILE* f = fopen(path, "r");
+    if (!f)
+    {
+        printf("cannot open %s\n", path);
+        return false;
+    }
+    std::map<std::string, uint32_t> names;
+    char     line[1024];
+    unsigned number = 0;
+    bool     ok = true;
+    while (ok && fgets(line, sizeof(line), f))
+    {
+        ++number;
+        if (char* comment = strchr(line, '#'))
+            *comment = 0;
+        std::vector<char*> words;
+        for (char* w = strtok(line, " \t\r\n"); w; w = strtok(NULL, " \t\r\n"))
+            words.push_back(w);
+        if (words.empty())
+            continue;
+
+        // numbers after the keyword, all of which must parse
+        auto numbers = [&] (size_t first, size_t count, float* out) {
+            if (words.size() < first + count)
+                return false;
+            for (size_t i = 0; i < count; ++i)
+            {
+                char* end;
+                out[i] = strtof(words[first + i], &end);
+                if (*end)
+                    return false;
+            }
+            return true;
+        };
+
+        if (!strcmp(words[0], "material") && words.size() >= 2)
+        {
+            MaterialRecord m = { { 1, 1, 1 }, 0, 0, 1, 0, 0 };
+            for (size_t i = 2; ok && i < words.size(); ++i)
+            {
+                if (!strcmp(words[i], "checker"))
+                    m.checker = 1;
+                else if (!strcmp(words[i], "diffuse"))
+                    ok = numbers(i + 1, 3, m.diffuse), i += 3;
+                else if (!strcmp(words[i], "reflection"))
+                    ok = numbers(i + 1, 1, &m.reflection), i += 1;
+                else if (!strcmp(words[i], "transparency"))
+                    ok = numbers(i + 1, 1, &m.transparency), i += 1;
+                else if (!strcmp(words[i], "ior"))
+                    ok = numbers(i + 1, 1, &m.ior), i += 1;
+                else
+                    ok = false;
+            }
+            names[words[1]] = data.materials.size();
+            data.materials.push_back(m);
+        }
+        else if (!strcmp(words[0], "light") && words.size() == 7)
+        {
+            LightRecord l;
+            ok = numbers(1, 3, l.position) && numbers(4, 3, l.color);
+            data.lights.push_back(l);
+        }
+        else if (!strcmp(words[0], "mesh") && words.size() == 3)
+        {
+            MeshRecord r = {};
+            auto m = names.find(words[2]);
+            ok = strlen(words[1]) < sizeof(r.path) && m != names.end();
+            if (ok)
+            {
+                strcpy(r.path, words[1]);
+                r.material = m->second;
+                data.meshes.push_back(r);
+            }
+        }
+        else if (!strcmp(words[0], "sphere") && words.size() == 6)
+        {
+            float v[4];
+            auto m = names.find(words[5]);
+            ok = numbers(1, 4, v) && m != names.end();
+            data.cx.push_back(v[0]);
+            data.cy.push_back(v[1]);
+            data.cz.push_back(v[2]);
+            data.radius.push_back(v[3]);
+            data.material.push_back(ok ? m->second : 0);
+        }
+        else
+            ok = false;
+    }
+    fclose(f);
+    if (!ok)
+        printf("%s:%u: cannot parse\n", path, number);
+    return ok;
+}
+
+inline bool write_text_scene(const SceneView& v, FILE* f)
+{
+    fprintf(f, "# %zu materials, %zu lights, %zu meshes, %zu spheres\n", v.materials, v.lights,
+            v.meshes, v.spheres);
+    for (size_t i = 0; i < v.materials; ++i)
+    {
+        auto& m = v.material[i];
+        fprintf(f, "material m%zu%s diffuse %g %g %g reflection %g transparency %g ior %g\n", i,
+                m.checker ? " checker" : "", m.diffuse[0], m.diffuse[1], m.diffuse[2],
+                m.reflection, m.transparency, m.ior);
+    }
+    for (size_t i = 0; i < v.lights; ++i)
+    {
+        auto& l = v.light[i];
+        fprintf(f, "light %g %g %g  %g %g %g\n", l.position[0], l.position[1], l.position[2],
+                l.color[0], l.color[1], l.color[2]);
+    }
+    for (size_t i = 0; i < v.meshes; ++i)
+        fprintf(f, "mesh %s m%u\n", v.mesh[i].path, v.mesh[i].material);
+    for (size_t i = 0; i < v.spheres; ++i)
+        fprintf(f, "sphere %.9g %.9g %.9g  %.9g  m%u\n", v.cx[i], v.cy[i], v.cz[i], v.radius[i],
+                v.sphere_material[i]);
+    return !ferror(f);
+}
+
+// binary form of v, handed to write(const void*, size_t) piece by piece;
+// false if a write failed
+template <typename Write>
+bool write_binary_scene(const SceneView& v, Write write)
+{
+    SceneHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, scene_magic, sizeof(h.magic));
+    h.version   = scene_version;
+    h.materials = v.materials;
+    h.lights    = v.lights;
+    h.meshes    = v.meshes;
+    h.spheres   = v.spheres;
+    SceneLayout layout(h);
+
+    // write a section at its offset, zero padding up to it
+    uint64_t at = 0;
+    bool     ok = true;
+    auto section = [&] (uint64_t offset, const void* p, size_t bytes) {
+        static const char zero[64] = {};
+        ok = ok && write(zero, size_t(offset - at));
+        ok = ok && (!bytes || write(p, bytes));
+        at = offset + bytes;
+    };
+    section(0,                &h,                  sizeof(h));
+    section(layout.materials, v.material,          v.materials * sizeof(MaterialRecord));
+    section(layout.lights,    v.light,             v.lights * sizeof(LightRecord));
+    section(layout.meshes,    v.mesh,              v.meshes * sizeof(MeshRecord));
+    section(layout.cx,        v.cx,                v.spheres * sizeof(float));
+    section(layout.cy,        v.cy,                v.spheres * sizeof(float));
+    section(layout.cz,        v.cz,                v.spheres * sizeof(float));
+    section(layout.radius,    v.radius,            v.spheres * sizeof(float));
+    section(layout.material,  v.sphere_material,   v.spheres * sizeof(uint32_t));
+    return ok;
+}
+
+inline bool write_binary_scene(const SceneView& v, const char* path)
+{
+    FILE* f = fopen(path, "wb");
+    if (!f)
+        return false;
+    bool ok = write_binary_scene(v, [f] (const void* p, size_t bytes) {
+        return fwrite(p, 1, bytes, f) == bytes;
+    });
+    return fclose(f) == 0 && ok;
+}
+
+// add the content of a scene file to scene; relative mesh paths are
+// taken from dir
+template <typename T>
+bool load_scene(const SceneView& v, Scene<T>& scene, const std::string& dir = "")
+{
+    for (size_t i = 0; i < v.spheres; ++i)
+        if (v.sphere_material[i] >= v.materials)
+            return false;
+    for (size_t i = 0; i < v.meshes; ++i)
+        if (v.mesh[i].material >= v.materials || !memchr(v.mesh[i].path, 0, sizeof(v.mesh[i].path)))
+            return false;
+
+    std::vector<const Material<T>*> table;
+    for (size_t i = 0; i < v.materials; ++i)
+    {
+        auto& r = v.material[i];
+        auto  m = scene.add(Surface<T>());
+        m->color        = { r.diffuse[0], r.diffuse[1], r.diffuse[2] };
+        m->checker      = r.checker != 0;
+        m->reflectivity = r.reflection;
+        m->transparent  = r.transparency;
+        m->index        = r.ior;
+        table.push_back(m);
+    }
+    for (size_t i = 0; i < v.lights; ++i)
+    {
+        auto& l = v.light[i];
+        scene.add(Light<T>({ l.position[0], l.position[1], l.position[2] },
+                           { l.color[0], l.color[1], l.color[2] }));
+    }
+
+    for (size_t i = 0; i < v.meshes; ++i)
+    {
+        const char* path = v.mesh[i].path;
+        std::string file = path[0] == '/' ? path : dir + path;
+        auto mesh = std::make_shared<MeshData<T>>();
+        if (!load_obj(file.c_str(), *mesh))
+            return false;
+        scene.add(TriangleMesh<T>(mesh, *table[v.mesh[i].material]));
+    }
+
+    auto& s = scene.spheres;
+    s.cx.insert(s.cx.end(), v.cx, v.cx + v.spheres);
+    s.cy.insert(s.cy.end(), v.cy, v.cy + v.spheres);
+    s.cz.insert(s.cz.end(), v.cz, v.cz + v.spheres);
+    s.radius.insert(s.radius.end(), v.radius, v.radius + v.spheres);
+    s.r2.reserve(s.r2.size() + v.spheres);
+    s.material.reserve(s.material.size() + v.spheres);
+    for (size_t i = 0; i < v.spheres; ++i)
+    {
+        s.r2.push_back(T(v.radius[i]) * T(v.radius[i]));
+        s.material.push_back(table[v.sphere_material[i]]);
+    }
+    return true;
+}
+
+// add the scene in a binary or text scene file to scene
+template <typename T>
+bool load_scene(const char* path, Scene<T>& scene)
+{
+    std::string dir(path);
+    dir.erase(dir.find_last_of('/') + 1);
+
+    MappedFile file(path);
+    SceneView  view;
+    if (is_binary_scene(file))
+    {
+        if (!map_binary_scene(file, view) || !load_scene(view, scene, dir))
+        {
+            printf("%s: bad binary scene\n", path);
+            return false;
+        }
+        return true;
+    }
+    SceneData data;
+    if (!read_text_scene(path, data))
+        return false;
+    if (!load_scene(data.view(), scene, dir))
+    {
+        printf("%s: bad scene\n", path);
+        return false;
+    }
+    return true;
+}
+
+// Scene file content of scene's spheres, meshes loaded from files, lights
+// and their materials. Returns false if the scene holds objects that have
+// no scene file form, which are left out, or materials drawn by their own
+// diffuse() (SHADE_VIRTUAL, such as textures), which are written as the
+// one color they have at the origin.
+template <typename T>
+bool describe_scene(const Scene<T>& scene, SceneData& data)
+{
+    bool complete = true;
+    std::map<const Material<T>*, uint32_t> index;
+    auto material = [&] (const Material<T>* m) {
+        auto i = index.find(m);
+        if (i != index.end())
+            return i->second;
+        auto p = m->params();
+        if (p.shading == SHADE_VIRTUAL)
+            complete = false;
+        MaterialRecord r = { { float(p.color[0]), float(p.color[1]), float(p.color[2]) },
+                             float(p.reflection), float(p.transparency), float(p.ior),
+                             p.shading == SHADE_CHECKER, 0 };
+        data.materials.push_back(r);
+        return index[m] = data.materials.size() - 1;
+    };
+    auto sphere = [&] (const Vec3<T>& c, T r, const Material<T>* m) {
+        data.cx.push_back(c[0]);
+        data.cy.push_back(c[1]);
+        data.cz.push_back(c[2]);
+        data.radius.push_back(r);
+        data.material.push_back(material(m));
+    };
+
+    for (auto o: scene.objects)
+        if (auto s = dynamic_cast<const Sphere<T>*>(o))
+            sphere(s->center(), s->radius(), &s->material());
+    for (auto o: scene.objects)
+    {
+        auto m = dynamic_cast<const TriangleMesh<T>*>(o);
+        if (m && !m->mesh()->source.empty() && m->mesh()->source.size() < sizeof(MeshRecord().path))
+        {
+            MeshRecord r = {};
+            strcpy(r.path, m->mesh()->source.c_str());
+            r.material = material(&m->material());
+            data.meshes.push_back(r);
+        }
+        else if (!dynamic_cast<const Sphere<T>*>(o))
+            complete = false;
+    }
+    for (size_t i = 0; i < scene.spheres.size(); ++i)
+        sphere(scene.spheres.center(i), scene.spheres.radius[i], scene.spheres.material[i]);
+    for (auto l: scene.lights)
+    {
+        LightRecord r;
+        for (int k = 0; k < 3; ++k)
+        {
+            r.position[k] = l->position()[k];
+            r.color[k]    = l->color()[k];
+        }
+        data.lights.push_back(r);
+    }
+    return complete;
+}
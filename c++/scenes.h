@@ -0,0 +1,197 @@
+#pragma once
+
+#include "scene.h"
+#include "mesh.h"
+#include "instance.h"
+#include "texture.h"
+#include <random>
+#include <cmath>
+#include <vector>
+
+// Parametric test scenes shared by the renderer and the benchmarks.
+// Objects refer to materials by reference, so these live for the whole
+// program.
+template <typename T>
+struct Materials
+{
+    CheckerBoard<T> checker_board;
+    Shiny<T>        shiny;
+    Glass<T>        glass;
+
+    static const Materials& get()
+    {
+        static Materials materials;
+        return materials;
+    }
+};
+
+// the five spheres and one light the renderer has always shown
+template <typename T>
+void default_scene(Scene<T>& scene)
+{
+    auto& m = Materials<T>::get();
+
+    // add objects
+    scene.add(Sphere<T>({0, -10002, -20}, 10000, m.checker_board));
+    scene.add(Sphere<T>({0, 2, -20},      4,     m.shiny));
+    scene.add(Sphere<T>({5, 0, -15},      2,     m.shiny));
+    scene.add(Sphere<T>({-5, 0, -15},     2,     m.shiny));
+    scene.add(Sphere<T>({-2, -1, -10},    1,     m.glass));
+    // add lights
+    scene.add(Light<T>({-10, 20, 30},  {2, 2, 2}));
+}
+
+// size x size RGB test image for textures: colored squares of 64 texels
+// with a fine grid inside, so that every mip level looks different
+inline void texture_pattern(unsigned size, std::vector<unsigned char>& rgb)
+{
+    rgb.resize(size_t(size) * size * 3);
+    for (unsigned y = 0; y < size; ++y)
+        for (unsigned x = 0; x < size; ++x)
+        {
+            unsigned char* p = &rgb[3 * (size_t(y) * size + x)];
+            unsigned square = (x / 64) * 7 + (y / 64) * 13;
+            bool line = x % 8 == 0 || y % 8 == 0;
+            p[0] = line ? 255 : 64 + square * 37 % 192;
+            p[1] = line ? 255 : 64 + square * 59 % 192;
+            p[2] = line ? 255 : 64 + square * 83 % 192;
+        }
+}
+
+// the default scene with an image texture, repeating every 8 units, on
+// the floor instead of the checker board; pixel_size as for
+// TextureMaterial
+template <typename T>
+void textured_scene(Scene<T>& scene, std::shared_ptr<const Texture> texture, T pixel_size)
+{
+    auto& m = Materials<T>::get();
+    auto floor = scene.add(TextureMaterial<T>(std::move(texture), T(8), pixel_size, T(0.1)));
+
+    scene.add(Sphere<T>({0, -10002, -20}, 10000, *floor));
+    scene.add(Sphere<T>({0, 2, -20},      4,     m.shiny));
+    scene.add(Sphere<T>({5, 0, -15},      2,     m.shiny));
+    scene.add(Sphere<T>({-5, 0, -15},     2,     m.shiny));
+    scene.add(Sphere<T>({-2, -1, -10},    1,     m.glass));
+    scene.add(Light<T>({-10, 20, 30},  {2, 2, 2}));
+}
+
+// n random spheres, one in ten of them glass, above the checker board
+// floor. The radius shrinks with n so the view stays about as full.
+template <typename T>
+void random_spheres(Scene<T>& scene, unsigned n, unsigned seed = 1)
+{
+    auto& m = Materials<T>::get();
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<T> x(-20, 20), y(-1, 10), z(-80, -15);
+    T r = T(6) / std::cbrt(T(n));
+
+    scene.add(Sphere<T>({0, -10002, -20}, 10000, m.checker_board));
+    for (unsigned i = 0; i < n; ++i)
+    {
+        const Material<T>& material = i % 10 ? static_cast<const Material<T>&>(m.shiny) : m.glass;
+        scene.add(Sphere<T>({x(rng), y(rng), z(rng)}, r, material));
+    }
+    scene.add(Light<T>({-10, 20, 30}, {2, 2, 2}));
+}
+
+// a cluster of n overlapping glass spheres straight ahead; every primary
+// ray splits into reflection and refraction at each surface, so this is
+// meant to be rendered with a large max_depth
+template <typename T>
+void deep_glass(Scene<T>& scene, unsigned n)
+{
+    auto& m = Materials<T>::get();
+    scene.add(Sphere<T>({0, -10002, -20}, 10000, m.checker_board));
+    for (unsigned i = 0; i < n; ++i)
+    {
+        T a = T(i) * T(2.4);    // spiral around the view axis
+        T d = T(i) / n;
+        scene.add(Sphere<T>({std::cos(a) * 2 * d, std::sin(a) * 1.5f * d, -8 - T(i) * 1.2f}, 1.5f, m.glass));
+    }
+    scene.add(Light<T>({-10, 20, 30}, {2, 2, 2}));
+}
+
+// closed torus around the z axis, u segments around the ring and v
+// around the tube
+template <typename T>
+void torus(MeshData<T>& mesh, unsigned u, unsigned v, T major, T minor)
+{
+    const T pi = T(3.1415926536);
+    for (unsigned i = 0; i < u; ++i)
+        for (unsigned j = 0; j < v; ++j)
+        {
+            T a = 2 * pi * i / u, b = 2 * pi * j / v;
+            T r = major + minor * std::cos(b);
+            mesh.positions.insert(mesh.positions.end(),
+                                  { r * std::cos(a), r * std::sin(a), minor * std::sin(b) });
+        }
+    for (unsigned i = 0; i < u; ++i)
+        for (unsigned j = 0; j < v; ++j)
+        {
+            uint32_t a = i * v + j, b = (i + 1) % u * v + j;
+            uint32_t c = (i + 1) % u * v + (j + 1) % v, d = i * v + (j + 1) % v;
+            mesh.indices.insert(mesh.indices.end(), { a, b, c, a, c, d });
+        }
+    mesh.build();
+}
+
+// n randomly turned copies of one torus mesh, one in ten of them glass,
+// above the checker board floor; the mesh is stored only once
+template <typename T>
+void instanced_tori(Scene<T>& scene, unsigned n, unsigned seed = 1)
+{
+    auto& m = Materials<T>::get();
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<T> x(-20, 20), y(-1, 10), z(-80, -15), unit(-1, 1), angle(0, 6.2831853f);
+    T s = T(4) / std::cbrt(T(n));
+
+    auto mesh = std::make_shared<MeshData<T>>();
+    torus(*mesh, 48u, 24u, T(1), T(0.35));
+    auto geometry = std::make_shared<TriangleMesh<T>>(mesh, m.shiny);
+
+    scene.add(Sphere<T>({0, -10002, -20}, 10000, m.checker_board));
+    for (unsigned i = 0; i < n; ++i)
+    {
+        Vec3<T> axis = { unit(rng), unit(rng), unit(rng) };
+        axis.normalize();
+        auto to_world = scaling(s) * rotation(axis, angle(rng)) * translation(Vec3<T>{x(rng), y(rng), z(rng)});
+        const Material<T>* material = i % 10 ? static_cast<const Material<T>*>(&m.shiny) : &m.glass;
+        scene.add(Instance<T>(geometry, to_world, material));
+    }
+    scene.add(Light<T>({-10, 20, 30}, {2, 2, 2}));
+}
+
+// Animation for the scenes above: every sphere but the first (the floor)
+// circles around where it started, each with its own phase.
+template <typename T>
+class Orbits
+{
+public:
+    explicit Orbits(Scene<T>& scene, T radius = 1) : m_radius(radius)
+    {
+        for (auto o: scene.objects)
+            if (auto s = dynamic_cast<Sphere<T>*>(o))
+                if (o != scene.objects.front())
+                    m_spheres.push_back({ s, s->center() });
+    }
+
+    // move the spheres to where they are in the given frame
+    void operator () (unsigned frame)
+    {
+        for (size_t i = 0; i < m_spheres.size(); ++i)
+        {
+            T a = T(frame) * T(0.1) + T(i);
+            m_spheres[i].sphere->move_to(m_spheres[i].start +
+                                         Vec3<T>{ std::cos(a), std::sin(a), 0 } * m_radius);
+        }
+    }
+
+private:
+    struct Moving
+    {
+        Sphere<T>* sphere;
+        Vec3<T>    start;
+    };
+    std::vector<Moving> m_spheres;
+    T                   m_radius;
+};
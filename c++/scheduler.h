@@ -0,0 +1,131 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// Persistent pool of worker threads. Each call to run() hands out task
+// indices [0, count) round-robin into per-thread deques; a worker pops
+// from the back of its own deque and, once that is empty, steals from the
+// front of the others, so expensive tasks never leave cores idle.
+class ThreadPool
+{
+public:
+    typedef std::function<void(unsigned task, unsigned worker)> Job;
+
+    explicit ThreadPool(unsigned threads) :
+        m_queues(threads ? threads : 1), m_job(nullptr), m_generation(0), m_running(0), m_quit(false)
+    {
+        // the calling thread acts as worker 0
+        for (unsigned i = 1; i < m_queues.size(); ++i)
+            m_threads.emplace_back([this, i] { loop(i); });
+    }
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_quit = true;
+        }
+        m_wake.notify_all();
+        for (auto& t: m_threads)
+            t.join();
+    }
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator = (const ThreadPool&) = delete;
+
+    unsigned size() const { return m_queues.size(); }
+
+    // run job(task, worker) for every task and block until all are done
+    void run(unsigned count, const Job& job)
+    {
+        for (unsigned i = 0; i < count; ++i)
+            m_queues[i % m_queues.size()].tasks.push_back(i);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_job = &job;
+            m_running = m_threads.size();
+            ++m_generation;
+        }
+        m_wake.notify_all();
+
+        work(0, job);
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock, [this] { return m_running == 0; });
+        m_job = nullptr;
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex          mutex;
+        std::deque<unsigned> tasks;
+    };
+
+    bool pop(unsigned worker, unsigned& task)
+    {
+        Queue& q = m_queues[worker];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.tasks.empty())
+            return false;
+        task = q.tasks.back();
+        q.tasks.pop_back();
+        return true;
+    }
+    bool steal(unsigned worker, unsigned& task)
+    {
+        for (unsigned i = 1; i < m_queues.size(); ++i)
+        {
+            Queue& q = m_queues[(worker + i) % m_queues.size()];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (!q.tasks.empty())
+            {
+                task = q.tasks.front();
+                q.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+    void work(unsigned worker, const Job& job)
+    {
+        unsigned task;
+        while (pop(worker, task) || steal(worker, task))
+            job(task, worker);
+    }
+    void loop(unsigned worker)
+    {
+        unsigned seen = 0;
+        for (;;)
+        {
+            const Job* job;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait(lock, [&] { return m_quit || m_generation != seen; });
+                if (m_quit)
+                    return;
+                seen = m_generation;
+                job = m_job;
+            }
+            work(worker, *job);
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (--m_running == 0)
+                    m_done.notify_one();
+            }
+        }
+    }
+
+    std::vector<Queue>       m_queues;
+    std::vector<std::thread> m_threads;
+    std::mutex               m_mutex;
+    std::condition_variable  m_wake;
+    std::condition_variable  m_done;
+    const Job*               m_job;
+    unsigned                 m_generation;
+    unsigned                 m_running;
+    bool                     m_quit;
+};
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cstdio>
+
+// Per-thread ray counters. Each thread bumps its own copy without
+// synchronization; collect() merges and resets them between frames. The
+// STAT() hooks compile to nothing unless RAY_STATS is defined.
+struct RayStats
+{
+    enum { depths = 32 };
+
+    unsigned long long primary    = 0;  // rays cast, by kind
+    unsigned long long shadow     = 0;
+    unsigned long long reflection = 0;
+    unsigned long long refraction = 0;
+    unsigned long long intersection_tests = 0;  // ray / primitive tests
+    unsigned long long shadow_tests = 0;        // of which for shadow rays
+    unsigned long long triangle_tests = 0;      // ray / triangle tests inside meshes
+    unsigned long long occluder_hits = 0;       // shadow rays blocked by the cached occluder
+    unsigned long long hits       = 0;  // nearest-hit queries that hit something
+    unsigned long long occluded   = 0;  // shadow rays that were blocked
+    unsigned long long cutoffs    = 0;  // secondary rays not cast because of max_depth
+    unsigned long long terminated = 0;  // ... or because their weight was below min_weight
+    unsigned long long survived   = 0;  // low weight rays kept by russian roulette
+    unsigned long long depth[depths] = {};  // trace() calls per recursion depth
+
+    unsigned long long rays() const
+    {
+        return primary + shadow + reflection + refraction;
+    }
+
+    RayStats& operator += (const RayStats& s)
+    {
+        primary    += s.primary;
+        shadow     += s.shadow;
+        reflection += s.reflection;
+        refraction += s.refraction;
+        intersection_tests += s.intersection_tests;
+        shadow_tests  += s.shadow_tests;
+        triangle_tests += s.triangle_tests;
+        occluder_hits += s.occluder_hits;
+        hits       += s.hits;
+        occluded   += s.occluded;
+        cutoffs    += s.cutoffs;
+        terminated += s.terminated;
+        survived   += s.survived;
+        for (int i = 0; i < depths; ++i)
+            depth[i] += s.depth[i];
+        return *this;
+    }
+
+    void print(FILE* f) const
+    {
+        fprintf(f, "rays               %llu\n", rays());
+        fprintf(f, "  primary          %llu\n", primary);
+        fprintf(f, "  shadow           %llu\n", shadow);
+        fprintf(f, "  reflection       %llu\n", reflection);
+        fprintf(f, "  refraction       %llu\n", refraction);
+        fprintf(f, "intersection tests %llu\n", intersection_tests);
+        fprintf(f, "  shadow           %llu\n", shadow_tests);
+        fprintf(f, "triangle tests     %llu\n", triangle_tests);
+        fprintf(f, "hits               %llu\n", hits);
+        fprintf(f, "shadow occluded    %llu\n", occluded);
+        fprintf(f, "  by cached        %llu\n", occluder_hits);
+        fprintf(f, "max_depth cutoffs  %llu\n", cutoffs);
+        fprintf(f, "low weight cutoffs %llu\n", terminated);
+        fprintf(f, "roulette survivors %llu\n", survived);
+        fprintf(f, "depth histogram\n");
+        for (int i = 0; i < depths; ++i)
+            if (depth[i])
+                fprintf(f, "  %2d               %llu\n", i, depth[i]);
+    }
+
+    void write_json(FILE* f) const
+    {
+        fprintf(f, "{ \"rays\": %llu, \"primary\": %llu, \"shadow\": %llu, \"reflection\": %llu, "
+                   "\"refraction\": %llu, \"intersection_tests\": %llu, \"shadow_tests\": %llu, "
+                   "\"triangle_tests\": %llu, \"hits\": %llu, \"occluded\": %llu, \"occluder_hits\": %llu, "
+                   "\"cutoffs\": %llu, \"terminated\": %llu, \"survived\": %llu, \"depth\": [",
+                rays(), primary, shadow, reflection, refraction, intersection_tests, shadow_tests,
+                triangle_tests, hits, occluded, occluder_hits, cutoffs, terminated, survived);
+        int last = depths - 1;
+        while (last > 0 && !depth[last])
+            --last;
+        for (int i = 0; i <= last; ++i)
+            fprintf(f, "%s%llu", i ? ", " : "", depth[i]);
+        fprintf(f, "] }\n");
+    }
+};
+
+class StatsRegistry
+{
+public:
+    static StatsRegistry& instance()
+    {
+        static StatsRegistry registry;
+        return registry;
+    }
+
+    // counters of the calling thread
+    static RayStats& local()
+    {
+        thread_local RayStats* stats = instance().add();
+        return *stats;
+    }
+
+    // sum of all threads' counters, which are reset; call between frames
+    RayStats collect()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        RayStats total;
+        for (auto& s: m_stats)
+        {
+            total += *s;
+            *s = RayStats();
+        }
+        return total;
+    }
+
+private:
+    RayStats* add()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stats.emplace_back(new RayStats());
+        return m_stats.back().get();
+    }
+
+    std::mutex                             m_mutex;
+    std::vector<std::unique_ptr<RayStats>> m_stats;
+};
+
+#ifdef RAY_STATS
+#define STAT(expr) (StatsRegistry::local().expr)
+#else
+#define STAT(expr) ((void)0)
+#endif
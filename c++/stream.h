@@ -0,0 +1,144 @@
+#pragma once
+
+#include "render.h"
+#include "image.h"
+#include <future>
+
+// Streaming output for frames too large to hold in memory. The frame is
+// rendered in horizontal bands, each a window of the whole frame (see
+// RenderSettings), and every band goes to the file as soon as it is done
+// while the next one is traced. Memory depends on the band size, not on
+// the image size.
+
+// Image file written a band of rows at a time: binary PPM through a
+// PostProcess, or PFM, whose rows are stored bottom to top and so are
+// written at their offsets. Methods return false on I/O errors.
+class ImageStream
+{
+public:
+    ImageStream() : m_file(NULL), m_pfm(false), m_width(0), m_height(0), m_header(0) {}
+    ~ImageStream() { if (m_file) fclose(m_file); }
+
+    // PNG is not written a band at a time
+    static bool streamable(const char* path)
+    {
+        std::string p(path);
+        std::string ext = p.size() >= 4 ? p.substr(p.size() - 4) : "";
+        return ext != ".png" && ext != ".PNG";
+    }
+
+    // PFM for a .pfm path, PPM otherwise
+    bool open(const char* path, unsigned width, unsigned height, const PostProcess& post = PostProcess())
+    {
+        std::string p(path);
+        std::string ext = p.size() >= 4 ? p.substr(p.size() - 4) : "";
+        m_pfm    = ext == ".pfm" || ext == ".PFM";
+        m_width  = width;
+        m_height = height;
+        m_post   = post;
+        m_file   = fopen(path, "wb");
+        if (!m_file)
+            return false;
+        if (m_pfm)
+        {
+            const uint16_t probe = 1;
+            bool little = *reinterpret_cast<const unsigned char*>(&probe) == 1;
+            fprintf(m_file, "PF\n%u %u\n%s\n", width, height, little ? "-1.0" : "1.0");
+        }
+        else
+            fprintf(m_file, "P6\n%u %u\n255\n", width, height);
+        m_header = ftell(m_file);
+        return m_header > 0;
+    }
+
+    // rows [y, y + n) of the image from rows [first, first + n) of fb,
+    // which is as wide as the image
+    bool write(const Framebuffer& fb, unsigned first, unsigned y, unsigned n)
+    {
+        if (m_pfm)
+        {
+            size_t row = 3 * sizeof(float) * size_t(m_width);
+            for (unsigned i = 0; i < n; ++i)
+                if (!seek(m_header + row * (m_height - 1 - (y + i))) ||
+                    fwrite(fb.pixel(0, first + i), row, 1, m_file) != 1)
+                    return false;
+            return true;
+        }
+        m_row.resize(3 * size_t(m_width));
+        for (unsigned i = 0; i < n; ++i)
+        {
+            m_post.convert(fb.pixel(0, first + i), m_row.data(), m_row.size());
+            if (fwrite(m_row.data(), 1, m_row.size(), m_file) != m_row.size())
+                return false;
+        }
+        return true;
+    }
+
+    bool close()
+    {
+        bool ok = fclose(m_file) == 0;
+        m_file = NULL;
+        return ok;
+    }
+
+private:
+    FILE*                      m_file;
+    bool                       m_pfm;
+    unsigned                   m_width;
+    unsigned                   m_height;
+    long                       m_header;
+    PostProcess                m_post;
+    std::vector<unsigned char> m_row;
+
+    // files past 2 GB need 64 bit offsets
+    bool seek(uint64_t offset)
+    {
+#ifdef _WIN32
+        return _fseeki64(m_file, offset, SEEK_SET) == 0;
+#else
+        return fseeko(m_file, off_t(offset), SEEK_SET) == 0;
+#endif
+    }
+};
+
+// Render a width x height frame in bands of band_rows rows into the file
+// at path. Each band is traced with a row of apron above and below so
+// antialiasing compares the same neighbours as in a render of the whole
+// frame, and the image is the same. Two bands are held: one is traced
+// while the other is written.
+template <typename T>
+bool render_streaming(const Scene<T>& scene, ThreadPool& pool, RenderSettings settings,
+                      unsigned width, unsigned height, unsigned band_rows,
+                      const char* path, const PostProcess& post = PostProcess())
+{
+    ImageStream out;
+    if (!out.open(path, width, height, post))
+        return false;
+    settings.frame_width  = width;
+    settings.frame_height = height;
+
+    Framebuffer       bands[2] = { Framebuffer(0, 0), Framebuffer(0, 0) };
+    std::future<bool> written;
+    bool              ok = true;
+    for (unsigned y = 0, k = 0; y < height && ok; y += band_rows, ++k)
+    {
+        unsigned n  = std::min(band_rows, height - y);
+        unsigned y0 = y ? y - 1 : 0;
+        unsigned y1 = std::min(y + n + 1, height);
+        Framebuffer& fb = bands[k % 2];
+        if (fb.width != width || fb.height != y1 - y0)
+            fb = Framebuffer(width, y1 - y0);
+        settings.window_y = y0;
+        render(scene, fb, pool, settings);
+
+        // the other band is free once its write is done
+        if (written.valid() && !(ok = written.get()))
+            break;
+        written = std::async(std::launch::async, [&out, &fb, y, y0, n] {
+            return out.write(fb, y - y0, y, n);
+        });
+    }
+    if (written.valid())
+        ok = written.get() && ok;
+    return out.close() && ok;
+}
@@ -0,0 +1,433 @@
+#pragma once
+
+#include "objects.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Image textures are read from texture files, which hold every mip level
+// of an 8 bit RGB image cut into square tiles of texture_tile texels:
+//
+//   TextureHeader, padded to texture_page bytes
+//   level 0 tiles, row by row, then level 1 tiles, ... down to 1 x 1
+//
+// A tile is texture_tile rows of texture_tile RGBA texels (the A byte is
+// unused), one page; tiles on the right and bottom edges repeat the last
+// texel. Colors are sRGB like the images they come from. Textures are
+// never held whole in memory: samples go through the process wide
+// TileCache, which reads tiles from the file as they are first needed.
+enum { texture_tile = 32, texture_page = texture_tile * texture_tile * 4 };
+
+struct TextureHeader
+{
+    char     magic[8];          // "RTTEX"
+    uint32_t version;
+    uint32_t width, height;     // of level 0
+    uint32_t levels;
+    uint32_t tile;              // texture_tile
+    uint32_t reserved;
+};
+
+struct TextureTile
+{
+    unsigned char texels[texture_page];
+};
+
+inline unsigned mip_levels(unsigned width, unsigned height)
+{
+    unsigned levels = 1;
+    while (width > 1 || height > 1)
+    {
+        width  = std::max(1u, width / 2);
+        height = std::max(1u, height / 2);
+        ++levels;
+    }
+    return levels;
+}
+
+// Write the width x height RGB image rgb, rows top to bottom, as a texture
+// file. Each mip level averages 2 x 2 texels of the one above it.
+inline bool write_texture(const char* path, const unsigned char* rgb, unsigned width, unsigned height)
+{
+    FILE* f = fopen(path, "wb");
+    if (!f)
+        return false;
+    TextureHeader h = { "RTTEX", 1, width, height, mip_levels(width, height), texture_tile, 0 };
+    std::vector<unsigned char> page(texture_page, 0);
+    memcpy(page.data(), &h, sizeof(h));
+    bool ok = fwrite(page.data(), texture_page, 1, f) == 1;
+
+    std::vector<unsigned char> level(rgb, rgb + size_t(width) * height * 3), smaller;
+    unsigned w = width, hh = height;
+    for (unsigned l = 0; ok && l < h.levels; ++l)
+    {
+        for (unsigned ty = 0; ok && ty < (hh + texture_tile - 1) / texture_tile; ++ty)
+            for (unsigned tx = 0; ok && tx < (w + texture_tile - 1) / texture_tile; ++tx)
+            {
+                for (unsigned y = 0; y < texture_tile; ++y)
+                    for (unsigned x = 0; x < texture_tile; ++x)
+                    {
+                        unsigned sx = std::min(tx * texture_tile + x, w - 1);
+                        unsigned sy = std::min(ty * texture_tile + y, hh - 1);
+                        memcpy(&page[4 * (y * texture_tile + x)], &level[3 * (size_t(sy) * w + sx)], 3);
+                    }
+                ok = fwrite(page.data(), texture_page, 1, f) == 1;
+            }
+
+        unsigned nw = std::max(1u, w / 2), nh = std::max(1u, hh / 2);
+        smaller.resize(size_t(nw) * nh * 3);
+        for (unsigned y = 0; y < nh; ++y)
+            for (unsigned x = 0; x < nw; ++x)
+                for (int c = 0; c < 3; ++c)
+                {
+                    unsigned x1 = std::min(2 * x + 1, w - 1), y1 = std::min(2 * y + 1, hh - 1);
+                    unsigned sum = level[3 * (size_t(2 * y) * w + 2 * x) + c] + level[3 * (size_t(2 * y) * w + x1) + c] +
+                                   level[3 * (size_t(y1) * w + 2 * x) + c] + level[3 * (size_t(y1) * w + x1) + c];
+                    smaller[3 * (size_t(y) * nw + x) + c] = (sum + 2) / 4;
+                }
+        level.swap(smaller);
+        w  = nw;
+        hh = nh;
+    }
+    return fclose(f) == 0 && ok;
+}
+
+// An open texture file. Tiles are read with positioned reads, so any
+// number of threads may read at once.
+class Texture
+{
+public:
+    Texture() : m_id(next_id()) {}
+    Texture(const Texture&) = delete;
+    Texture& operator = (const Texture&) = delete;
+    ~Texture() { close(); }
+
+    // false, with a message, if path is not a texture file
+    bool open(const char* path)
+    {
+        close();
+#ifndef _WIN32
+        m_fd = ::open(path, O_RDONLY);
+        bool ok = m_fd >= 0 && pread(m_fd, &m_header, sizeof(m_header), 0) == ssize_t(sizeof(m_header));
+#else
+        m_file = fopen(path, "rb");
+        bool ok = m_file && fread(&m_header, sizeof(m_header), 1, m_file) == 1;
+#endif
+        ok = ok && !memcmp(m_header.magic, "RTTEX", 6) && m_header.version == 1 && m_header.tile == texture_tile &&
+             m_header.width && m_header.height && m_header.levels == mip_levels(m_header.width, m_header.height);
+        if (!ok)
+        {
+            printf("%s is not a texture file\n", path);
+            close();
+            return false;
+        }
+        m_offsets.clear();
+        uint64_t offset = texture_page;
+        for (unsigned l = 0; l < m_header.levels; ++l)
+        {
+            m_offsets.push_back(offset);
+            offset += uint64_t(tiles_x(l)) * tiles_y(l) * texture_page;
+        }
+        m_path = path;
+        return true;
+    }
+
+    unsigned    width(unsigned level = 0)  const { return std::max(1u, m_header.width >> level); }
+    unsigned    height(unsigned level = 0) const { return std::max(1u, m_header.height >> level); }
+    unsigned    levels()  const { return m_header.levels; }
+    unsigned    tiles_x(unsigned level) const { return (width(level) + texture_tile - 1) / texture_tile; }
+    unsigned    tiles_y(unsigned level) const { return (height(level) + texture_tile - 1) / texture_tile; }
+    uint32_t    id()      const { return m_id; }     // never reused, for cache keys
+    const std::string& path() const { return m_path; }
+
+    bool read_tile(unsigned level, unsigned tx, unsigned ty, TextureTile& tile) const
+    {
+        uint64_t offset = m_offsets[level] + (uint64_t(ty) * tiles_x(level) + tx) * texture_page;
+#ifndef _WIN32
+        return pread(m_fd, tile.texels, texture_page, offset) == texture_page;
+#else
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return _fseeki64(m_file, offset, SEEK_SET) == 0 && fread(tile.texels, texture_page, 1, m_file) == 1;
+#endif
+    }
+
+    // Linear color at (u, v), which wrap around at 1, filtered bilinearly
+    // within and linearly between the mip levels around lod.
+    template <typename T>
+    Vec3<T> sample(T u, T v, T lod) const;
+
+private:
+    static uint32_t next_id()
+    {
+        static std::atomic<uint32_t> id(0);
+        return id++;
+    }
+    void close()
+    {
+#ifndef _WIN32
+        if (m_fd >= 0)
+            ::close(m_fd);
+        m_fd = -1;
+#else
+        if (m_file)
+            fclose(m_file);
+        m_file = NULL;
+#endif
+    }
+
+    template <typename T>
+    Vec3<T> bilinear(unsigned level, T u, T v) const;
+
+    TextureHeader         m_header = {};
+    std::vector<uint64_t> m_offsets;            // of each level
+    std::string           m_path;
+    uint32_t              m_id;
+#ifndef _WIN32
+    int                   m_fd = -1;
+#else
+    FILE*                 m_file = NULL;
+    mutable std::mutex    m_mutex;
+#endif
+};
+
+struct TileCacheStats
+{
+    unsigned long long lookups    = 0;  // that got past the per-thread tiles
+    unsigned long long hits       = 0;
+    unsigned long long misses     = 0;  // tiles read from disk
+    unsigned long long evictions  = 0;
+    unsigned long long bytes_read = 0;
+    size_t             resident   = 0;  // bytes of tiles held now
+    size_t             capacity   = 0;
+
+    double hit_rate() const { return lookups ? double(hits) / lookups : 1; }
+
+    void print(FILE* f) const
+    {
+        fprintf(f, "texture tile cache %zu / %zu KB\n", resident / 1024, capacity / 1024);
+        fprintf(f, "  lookups          %llu\n", lookups);
+        fprintf(f, "  hits             %llu (%.1f%%)\n", hits, 100 * hit_rate());
+        fprintf(f, "  misses           %llu\n", misses);
+        fprintf(f, "  evictions        %llu\n", evictions);
+        fprintf(f, "  read             %llu KB\n", bytes_read / 1024);
+    }
+};
+
+// Process wide cache of texture tiles with a bounded size, split into
+// shards with their own lock and least recently used list so threads
+// rarely wait on each other. In front of it each thread keeps the last few
+// tiles it used, without any locking. Tiles stay alive while a thread
+// still holds them, so memory may exceed the capacity by that many tiles
+// per thread.
+class TileCache
+{
+public:
+    static TileCache& instance()
+    {
+        static TileCache cache;
+        return cache;
+    }
+
+    void set_capacity(size_t bytes)
+    {
+        for (auto& s: m_shards)
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            s.capacity = std::max<size_t>(bytes / shards, texture_page);
+            evict(s);
+        }
+    }
+
+    // RGBA texel (x, y) of a level of texture
+    const unsigned char* texel(const Texture& texture, unsigned level, unsigned x, unsigned y)
+    {
+        uint64_t key = uint64_t(texture.id()) << 48 | uint64_t(level) << 42 |
+                       uint64_t(y / texture_tile) << 21 | (x / texture_tile);
+        static thread_local Front fronts[front_tiles];
+        Front& front = fronts[(key ^ key >> 21 ^ key >> 42) % front_tiles];
+        if (front.key != key || !front.tile)
+        {
+            front.tile = tile(texture, key, level, x / texture_tile, y / texture_tile);
+            front.key  = key;
+        }
+        return &front.tile->texels[4 * ((y % texture_tile) * texture_tile + x % texture_tile)];
+    }
+
+    TileCacheStats stats() const
+    {
+        TileCacheStats total;
+        for (auto& s: m_shards)
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            total.lookups    += s.stats.lookups;
+            total.hits       += s.stats.hits;
+            total.misses     += s.stats.misses;
+            total.evictions  += s.stats.evictions;
+            total.bytes_read += s.stats.bytes_read;
+            total.resident   += s.resident;
+            total.capacity   += s.capacity;
+        }
+        return total;
+    }
+
+    // empty the cache and zero its counters
+    void clear()
+    {
+        for (auto& s: m_shards)
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            s.lru.clear();
+            s.map.clear();
+            s.resident = 0;
+            s.stats = TileCacheStats();
+        }
+    }
+
+private:
+    enum { shards = 16, front_tiles = 8 };
+    typedef std::shared_ptr<const TextureTile> TilePtr;
+
+    struct Entry
+    {
+        uint64_t key;
+        TilePtr  tile;
+    };
+    struct Shard
+    {
+        mutable std::mutex mutex;
+        std::list<Entry>   lru;             // most recently used first
+        std::unordered_map<uint64_t, std::list<Entry>::iterator> map;
+        size_t             resident = 0;
+        size_t             capacity = 64 * 1024 * 1024 / shards;
+        TileCacheStats     stats;
+    };
+    struct Front
+    {
+        uint64_t key = 0;
+        TilePtr  tile;
+    };
+
+    TilePtr tile(const Texture& texture, uint64_t key, unsigned level, unsigned tx, unsigned ty)
+    {
+        Shard& s = m_shards[(key * 0x9e3779b97f4a7c15ull) >> 60];
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            ++s.stats.lookups;
+            auto i = s.map.find(key);
+            if (i != s.map.end())
+            {
+                ++s.stats.hits;
+                s.lru.splice(s.lru.begin(), s.lru, i->second);
+                return i->second->tile;
+            }
+        }
+
+        // read without holding the lock; a tile that fails to read is black
+        auto t = std::make_shared<TextureTile>();
+        if (!texture.read_tile(level, tx, ty, *t))
+            memset(t->texels, 0, sizeof(t->texels));
+
+        std::lock_guard<std::mutex> lock(s.mutex);
+        ++s.stats.misses;
+        s.stats.bytes_read += texture_page;
+        auto i = s.map.find(key);
+        if (i != s.map.end())               // another thread was quicker
+            return i->second->tile;
+        s.lru.push_front({ key, t });
+        s.map[key] = s.lru.begin();
+        s.resident += texture_page;
+        evict(s);
+        return t;
+    }
+
+    static void evict(Shard& s)
+    {
+        while (s.resident > s.capacity && s.lru.size() > 1)
+        {
+            s.map.erase(s.lru.back().key);
+            s.lru.pop_back();
+            s.resident -= texture_page;
+            ++s.stats.evictions;
+        }
+    }
+
+    Shard m_shards[shards];
+};
+
+template <typename T>
+Vec3<T> Texture::bilinear(unsigned level, T u, T v) const
+{
+    // sRGB to linear, as the output conversion applies gamma 1 / 2.2
+    static const std::vector<T> linear = [] {
+        std::vector<T> table(256);
+        for (int i = 0; i < 256; ++i)
+            table[i] = T(std::pow(i / 255.0, 2.2));
+        return table;
+    }();
+
+    int w = width(level), h = height(level);
+    T x = (u - std::floor(u)) * w - T(0.5), y = (v - std::floor(v)) * h - T(0.5);
+    T x0 = std::floor(x), y0 = std::floor(y);
+    T fx = x - x0, fy = y - y0;
+    auto& cache = TileCache::instance();
+    auto at = [&] (int tx, int ty) {
+        auto p = cache.texel(*this, level, unsigned((tx % w + w) % w), unsigned((ty % h + h) % h));
+        return Vec3<T>{ linear[p[0]], linear[p[1]], linear[p[2]] };
+    };
+    int ix = int(x0), iy = int(y0);
+    return (at(ix, iy)     * (1 - fx) + at(ix + 1, iy)     * fx) * (1 - fy) +
+           (at(ix, iy + 1) * (1 - fx) + at(ix + 1, iy + 1) * fx) * fy;
+}
+
+template <typename T>
+Vec3<T> Texture::sample(T u, T v, T lod) const
+{
+    lod = std::min(std::max(lod, T(0)), T(levels() - 1));
+    unsigned level = unsigned(lod);
+    T        f     = lod - level;
+    auto color = bilinear(level, u, v);
+    if (f > 0)
+        color = color * (1 - f) + bilinear(level + 1, u, v) * f;
+    return color;
+}
+
+// Diffuse color from an image texture laid on the xz plane, repeating
+// every scale units. There are no ray differentials to size a pixel's
+// footprint with, so the mip level comes from the distance to the camera
+// at the origin times pixel_size, the width of a pixel at distance 1.
+template<typename T>
+struct TextureMaterial : Material<T>
+{
+    TextureMaterial(std::shared_ptr<const Texture> texture, T scale, T pixel_size, T reflectivity = 0) :
+        m_texture(std::move(texture)), m_scale(scale), m_pixel_size(pixel_size), m_reflectivity(reflectivity)
+    {}
+
+    Vec3<T> diffuse (const Vec3<T>& pos) const
+    {
+        T texels = pos.magnitude() * m_pixel_size / m_scale * m_texture->width();
+        T lod    = texels > 1 ? std::log2(texels) : T(0);
+        return m_texture->sample(pos[0] / m_scale, pos[2] / m_scale, lod);
+    }
+    T reflection() const { return m_reflectivity; }
+
+    const Texture& texture() const { return *m_texture; }
+
+private:
+    std::shared_ptr<const Texture> m_texture;
+    T                              m_scale;
+    T                              m_pixel_size;
+    T                              m_reflectivity;
+};
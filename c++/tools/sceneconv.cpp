@@ -0,0 +1,101 @@
+// Converts scene files between the text and the binary form (see
+// scenefile.h), or writes out one of the built-in test scenes. The output
+// is text if its name ends in .txt and binary otherwise:
+//
+//   sceneconv scene.txt scene.bin
+//   sceneconv -s spheres-10000000 big.bin
+#include "../scenefile.h"
+#include "../scenes.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+// fill scene with a built-in scene named default, spheres-N or glass-N
+static bool builtin_scene(const char* name, Scene<float>& scene)
+{
+    if (!strcmp(name, "default"))
+        default_scene(scene);
+    else if (!strncmp(name, "spheres-", 8) && atoi(name + 8) > 0)
+        random_spheres(scene, atoi(name + 8));
+    else if (!strncmp(name, "glass-", 6) && atoi(name + 6) > 0)
+        deep_glass(scene, atoi(name + 6));
+    else
+        return false;
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    const char* builtin = NULL;
+    const char* input   = NULL;
+    const char* output  = NULL;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "-s") && i + 1 < argc)
+            builtin = argv[++i];
+        else if (!input && !builtin && argv[i][0] != '-')
+            input = argv[i];
+        else if (!output && argv[i][0] != '-')
+            output = argv[i];
+        else
+            output = NULL, i = argc;
+    }
+    if (!output || (!input && !builtin))
+    {
+        printf("usage: %s input.txt|input.bin output.txt|output.bin\n"
+               "       %s -s default|spheres-N|glass-N output.txt|output.bin\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    SceneData  data;
+    SceneView  view;
+    MappedFile file(input ? input : "");
+    if (builtin)
+    {
+        Scene<float> scene;
+        if (!builtin_scene(builtin, scene))
+        {
+            printf("unknown scene %s\n", builtin);
+            return 1;
+        }
+        if (!describe_scene(scene, data))
+            printf("%s: objects or materials without a scene file form are left out or flattened\n", builtin);
+        view = data.view();
+    }
+    else
+    {
+        // binary input is written straight from the mapping
+        if (is_binary_scene(file))
+        {
+            if (!map_binary_scene(file, view))
+            {
+                printf("%s: bad binary scene\n", input);
+                return 1;
+            }
+        }
+        else if (read_text_scene(input, data))
+            view = data.view();
+        else
+            return 1;
+    }
+
+    std::string o(output);
+    bool ok;
+    if (o.size() >= 4 && o.substr(o.size() - 4) == ".txt")
+    {
+        FILE* f = fopen(output, "w");
+        ok = f && write_text_scene(view, f);
+        ok = f && fclose(f) == 0 && ok;
+    }
+    else
+        ok = write_binary_scene(view, output);
+    if (!ok)
+    {
+        printf("cannot write %s\n", output);
+        return 1;
+    }
+    printf("%zu materials, %zu lights, %zu meshes, %zu spheres\n", view.materials, view.lights,
+           view.meshes, view.spheres);
+    return 0;
+}
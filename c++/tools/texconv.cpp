@@ -0,0 +1,73 @@
+// Converts a binary PPM image into a texture file (see texture.h), or
+// writes out the test pattern of a given size:
+//
+//   texconv wood.ppm wood.tex
+//   texconv -g 4096 pattern.tex
+#include "../texture.h"
+#include "../scenes.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// 8 bit binary PPM
+static bool read_ppm(const char* path, unsigned& width, unsigned& height, std::vector<unsigned char>& rgb)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f)
+    {
+        printf("cannot open %s\n", path);
+        return false;
+    }
+    unsigned max = 0;
+    bool ok = fscanf(f, "P6 %u %u %u", &width, &height, &max) == 3 && max == 255 && width && height &&
+              fgetc(f) != EOF;
+    if (ok)
+    {
+        rgb.resize(size_t(width) * height * 3);
+        ok = fread(rgb.data(), rgb.size(), 1, f) == 1;
+    }
+    fclose(f);
+    if (!ok)
+        printf("%s is not an 8 bit binary PPM\n", path);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned    pattern = 0;
+    const char* input   = NULL;
+    const char* output  = NULL;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "-g") && i + 1 < argc)
+            pattern = std::max(1, atoi(argv[++i]));
+        else if (!input && !pattern && argv[i][0] != '-')
+            input = argv[i];
+        else if (!output && argv[i][0] != '-')
+            output = argv[i];
+        else
+            output = NULL, i = argc;
+    }
+    if (!output || (!input && !pattern))
+    {
+        printf("usage: %s input.ppm output.tex\n"
+               "       %s -g size output.tex\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    unsigned width = pattern, height = pattern;
+    std::vector<unsigned char> rgb;
+    if (pattern)
+        texture_pattern(pattern, rgb);
+    else if (!read_ppm(input, width, height, rgb))
+        return 1;
+
+    if (!write_texture(output, rgb.data(), width, height))
+    {
+        printf("cannot write %s\n", output);
+        return 1;
+    }
+    printf("%ux%u, %u levels\n", width, height, mip_levels(width, height));
+    return 0;
+}
@@ -0,0 +1,323 @@
+#pragma once
+
+#include "scene.h"
+#include "stats.h"
+#include <limits>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <new>
+#include <type_traits>
+
+// Deepest bounce the integrator keeps state for; scene.max_depth beyond
+// this is clamped so the ray stack below has a fixed size.
+enum { max_trace_depth = 31 };
+
+// One ray on the integrator's stack: where it hit, the light gathered there
+// so far and which secondary ray it spawns next.
+template <typename T>
+struct TraceFrame
+{
+    enum { REFLECT, REFRACT, DONE };
+
+    Ray<T>                   ray;
+    int                      depth;
+    T                        weight;        // contribution of this ray to the pixel
+    T                        scale;         // russian roulette compensation
+    int                      next;
+    Vec3<T>                  point;
+    Vec3<T>                  normal;
+    bool                     inside;
+    const MaterialParams<T>* material;      // in scene.prims.materials()
+    T                        fresnel;
+    Vec3<T>                  color;
+
+    // light this ray passes to its parent
+    Vec3<T> result() const { return scale == 1 ? color : color * scale; }
+};
+
+// Fixed capacity stack of pending rays, one frame per bounce. Frames are
+// constructed only when pushed.
+template <typename T>
+class RayStack
+{
+public:
+    enum { capacity = max_trace_depth + 1 };
+
+    RayStack() : m_size(0) {}
+
+    bool           empty() const { return m_size == 0; }
+    TraceFrame<T>& top()         { return frames()[m_size - 1]; }
+    TraceFrame<T>& push()        { return *new (&frames()[m_size++]) TraceFrame<T>; }
+    void           pop()         { --m_size; }
+
+private:
+    TraceFrame<T>* frames() { return reinterpret_cast<TraceFrame<T>*>(m_storage); }
+
+    typename std::aligned_storage<sizeof(TraceFrame<T>), alignof(TraceFrame<T>)>::type m_storage[capacity];
+    unsigned m_size;
+};
+
+// deepest bounce secondary() follows
+template<typename T>
+int depth_limit(const Scene<T>& scene)
+{
+    return int(std::min(scene.max_depth, unsigned(max_trace_depth)));
+}
+
+// fill in the surface of frame f for a ray that hit part of primitive hit
+// and the fresnel term that weights its secondary rays; its light starts
+// black
+template<typename T>
+void surface(TraceFrame<T>& f, int hit, unsigned part, T nearest, const Scene<T>& scene)
+{
+    STAT(hits++);
+
+    f.next   = TraceFrame<T>::REFLECT;
+	f.point  = f.ray.start + f.ray.dir * nearest;
+	f.normal = scene.prims.normal(hit, f.point, part);
+    f.inside = false;
+
+    // normal should always face the origin
+	if (f.normal.dot(f.ray.dir) > 0)
+    {
+        f.inside = true;
+        f.normal = -f.normal;
+    }
+
+    f.color    = Vec3<T>(0);
+    f.material = &scene.prims.material(hit);
+    T reflection_ratio = f.material->reflection;
+
+    T facing = std::max(T(0), -f.ray.dir.dot(f.normal));
+    f.fresnel = reflection_ratio + (1 - reflection_ratio) * pow((1 - facing), 5);
+
+    STAT(cutoffs += f.depth >= depth_limit(scene) && reflection_ratio > 0);
+    STAT(cutoffs += f.depth >= depth_limit(scene) && f.material->transparency > 0);
+}
+
+// Per-thread cache of the primitive slot that last blocked each light.
+// Neighbouring shadow rays tend to be blocked by the same object.
+inline int* last_occluder(unsigned light)
+{
+    static thread_local std::vector<int> slots;
+    if (light >= slots.size())
+        slots.resize(light + 1, -1);
+    return &slots[light];
+}
+
+// shadow ray from f's surface towards light l, which is *distance away;
+// *light receives what l adds to f's color unless the ray is blocked
+template<typename T>
+Ray<T> shadow_ray(const TraceFrame<T>& f, const Light<T>& l, const Vec3<T>& diffuse_color,
+                  Vec3<T>* light, T* distance)
+{
+    auto to_light = l.position() - f.point;
+    auto light_direction = to_light.normalized();
+    *distance = std::sqrt(to_light.dot(to_light));
+    *light = l.color()
+        * std::max(T(0), f.normal.dot(light_direction))
+        * diffuse_color
+        * (T(1) - f.material->reflection);
+    return {f.point + f.normal * 1e-5, light_direction};
+}
+
+// surface and direct light of frame f
+template<typename T>
+void hit_frame(TraceFrame<T>& f, int hit, unsigned part, T nearest, const Scene<T>& scene)
+{
+    surface(f, hit, part, nearest, scene);
+	Vec3<T> diffuse_color = diffuse(*f.material, f.point);
+
+    // compute diffuse light
+    // add up incoming light from all light sources
+    unsigned index = 0;
+    for(auto& l: scene.lights)
+    {
+        Vec3<T> light;
+        T       distance;
+        auto ray = shadow_ray(f, *l, diffuse_color, &light, &distance);
+
+        // go through the scene check whether we're blocked from the lights
+        STAT(shadow++);
+        bool blocked = scene.occluded(ray, distance, last_occluder(index++));
+        STAT(occluded += blocked);
+        if (!blocked)
+            f.color += light;
+    }
+}
+
+// uniform number in [0, 1) hashed from the ray, so that roulette does not
+// depend on which thread traces what
+template<typename T>
+T ray_random(const Ray<T>& ray)
+{
+    uint64_t h = 0;
+    for (int i = 0; i < 3; ++i)
+    {
+        uint64_t a = 0, b = 0;
+        memcpy(&a, &ray.start[i], sizeof(T));
+        memcpy(&b, &ray.dir[i], sizeof(T));
+        h = (h ^ a ^ (b << 1)) * 0x9e3779b97f4a7c15ull;
+        h ^= h >> 31;
+    }
+    return T(h >> 11) / T(1ull << 53);
+}
+
+// Contribution cutoff for a secondary ray of weight *weight. Rays below
+// scene.min_weight are dropped, or with scene.roulette survive with
+// probability weight / min_weight and have their light scaled up by *scale
+// to keep the image unbiased.
+template<typename T>
+bool worth_tracing(const Scene<T>& scene, const Ray<T>& ray, T* weight, T* scale)
+{
+    *scale = 1;
+    if (*weight >= scene.min_weight)
+        return true;
+    if (scene.roulette)
+    {
+        T p = *weight / scene.min_weight;
+        if (ray_random(ray) < p)
+        {
+            STAT(survived++);
+            *scale  = T(1) / p;
+            *weight = scene.min_weight;
+            return true;
+        }
+    }
+    STAT(terminated++);
+    return false;
+}
+
+// next secondary ray of frame f with its weight and roulette scale; false
+// once the reflected and refracted rays have both been spawned or skipped
+template<typename T>
+bool secondary(TraceFrame<T>& f, const Scene<T>& scene, Ray<T>* ray, T* weight, T* scale)
+{
+    int max_depth = depth_limit(scene);
+    switch (f.next)
+    {
+    case TraceFrame<T>::REFLECT:
+        f.next = TraceFrame<T>::REFRACT;
+        // compute reflection
+        if (f.depth < max_depth && f.material->reflection > 0)
+        {
+            auto reflection_direction = f.ray.dir + f.normal * 2 * f.ray.dir.dot(f.normal) * T(-1);
+            *ray    = Ray<T>(f.point + f.normal * 1e-5, reflection_direction);
+            *weight = f.weight * f.fresnel;
+            if (worth_tracing(scene, *ray, weight, scale))
+            {
+                STAT(reflection++);
+                return true;
+            }
+        }
+        // fall through
+    case TraceFrame<T>::REFRACT:
+        f.next = TraceFrame<T>::DONE;
+        // compute refraction
+        if (f.depth < max_depth && (f.material->transparency > 0))
+        {
+            auto CE = f.ray.dir.dot(f.normal) * T(-1);
+            auto ior = f.inside ? T(1) / f.material->ior : f.material->ior;
+            auto eta = T(1) / ior;
+            auto GF = (f.ray.dir + f.normal * CE) * eta;
+            auto sin_t1_2 = 1 - CE * CE;
+            auto sin_t2_2 = sin_t1_2 * (eta * eta);
+            if (sin_t2_2 < T(1))
+            {
+                auto GC = f.normal * sqrt(1 - sin_t2_2);
+                auto refraction_direction = GF - GC;
+                *ray    = Ray<T>(f.point - f.normal * 1e-5, refraction_direction);
+                *weight = f.weight * (1 - f.fresnel) * f.material->transparency;
+                if (worth_tracing(scene, *ray, weight, scale))
+                {
+                    STAT(refraction++);
+                    return true;
+                }
+            }
+        }
+        // fall through
+    default:
+        return false;
+    }
+}
+
+// add the color seen by one of f's secondary rays, in the same order and
+// with the same rounding as the recursive form color += child * weight
+template<typename T>
+void gather(TraceFrame<T>& f, const Vec3<T>& child, bool reflected)
+{
+    if (reflected)
+        f.color += child * f.fresnel;
+    else
+        f.color += child * (1 - f.fresnel) * f.material->transparency;
+}
+
+// Color seen along a ray whose nearest hit is part of primitive hit at
+// distance nearest. Reflected and refracted rays are followed depth first on an
+// explicit stack instead of by recursion; a frame is popped once both its
+// secondary rays have been gathered.
+template<typename T>
+Vec3<T> shade(const Ray<T>& ray, int hit, unsigned part, T nearest, const Scene<T>& scene, int depth)
+{
+	if (hit < 0)                // no hit
+        return Vec3<T>(0);      // return black
+
+    RayStack<T> stack;
+    TraceFrame<T>& root = stack.push();
+    root.ray    = ray;
+    root.depth  = depth;
+    root.weight = T(1);
+    root.scale  = T(1);
+    hit_frame(root, hit, part, nearest, scene);
+
+    for (;;)
+    {
+        TraceFrame<T>& f = stack.top();
+        Ray<T> next;
+        T      weight, scale;
+        if (secondary(f, scene, &next, &weight, &scale))
+        {
+            T d = std::numeric_limits<T>::max();
+            STAT(depth[std::min(f.depth + 1, int(RayStats::depths) - 1)]++);
+            unsigned p = 0;
+            int h = scene.intersect(next, &d, &p);
+            if (h < 0)
+            {
+                gather(f, Vec3<T>(0), f.next == TraceFrame<T>::REFRACT);
+                continue;
+            }
+            TraceFrame<T>& child = stack.push();
+            child.ray    = next;
+            child.depth  = f.depth + 1;
+            child.weight = weight;
+            child.scale  = scale;
+            hit_frame(child, h, p, d, scene);
+            continue;
+        }
+
+        Vec3<T> color = f.result();
+        stack.pop();
+        if (stack.empty())
+            return color;
+        gather(stack.top(), color, stack.top().next == TraceFrame<T>::REFRACT);
+    }
+}
+
+// color seen along a ray, depth bounces away from the camera; *hit, if
+// given, receives the primitive the ray hit first or -1
+template<typename T>
+Vec3<T> trace(const Ray<T>& ray, const Scene<T>& scene, int depth, int* hit = NULL)
+{
+	T nearest = std::numeric_limits<T>::max();
+    STAT(primary += depth == 0);
+    STAT(depth[std::min(depth, int(RayStats::depths) - 1)]++);
+
+    // search the scene for nearest intersection
+    unsigned part = 0;
+	int first = scene.intersect(ray, &nearest, &part);
+    if (hit)
+        *hit = first;
+
+    return shade(ray, first, part, nearest, scene, depth);
+}
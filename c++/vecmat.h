@@ -7,78 +7,83 @@
 #include <numeric>
 
 template<typename T, std::size_t N>
-class Vec : public std::array<T, N>
+class Vec;
+
+// Element-wise implementation shared by every Vec; V is the derived
+// vector type returned by the operators.
+template<typename V, typename T, std::size_t N>
+class VecBase : public std::array<T, N>
 {
 public:
-    Vec() { std::fill_n(this->begin(), N, T()); }
+    VecBase() { std::fill_n(this->begin(), N, T()); }
     template <typename U>
-    Vec(const Vec<U, N>& other) { std::copy_n(other.begin(), N, this->begin()); }
-    Vec(const T& v) { std::fill_n(this->begin(), N, v); }
-    Vec(std::initializer_list<T> l) { std::copy_n(l.begin(), N, this->begin()); }
+    VecBase(const Vec<U, N>& other) { std::copy_n(other.begin(), N, this->begin()); }
+    VecBase(const T& v) { std::fill_n(this->begin(), N, v); }
+    VecBase(std::initializer_list<T> l) { std::copy_n(l.begin(), N, this->begin()); }
 
     template <typename OP>
-    Vec& transform(OP op)
+    V& transform(OP op)
     {
         std::transform(this->begin(), this->end(), this->begin(), op);
-        return *this;
+        return self();
     }
     template <typename OP, typename U>
-    Vec& transform(const Vec<U, N>& u, OP op)
+    V& transform(const std::array<U, N>& u, OP op)
     {
         std::transform(this->begin(), this->end(), u.begin(), this->begin(), op);
-        return *this;
+        return self();
     }
     
     // *** multiply scalar
-    Vec& operator *= (const T& x)
+    V& operator *= (const T& x)
     {
         return transform([&] (T v) { return v * x; } );
     }
-    Vec operator * (const T& x)
+    V operator * (const T& x) const
     {
-        Vec<T, N> t(*this); t *= x; return t;
+        V t(self()); t *= x; return t;
     }
     // *** multiply vector
-    Vec& operator *= (const Vec& v)
+    V& operator *= (const V& v)
     {
         return transform(v, std::multiplies<T>());
     }    
-    Vec operator * (const Vec& v) const
+    V operator * (const V& v) const
     {
-        Vec<T, N> t(*this); t *= v; return t;
+        V t(self()); t *= v; return t;
     }
     // *** add vector
-    Vec& operator += (const Vec& v)
+    V& operator += (const V& v)
     {
         return transform(v, std::plus<T>());
     }    
-    Vec operator + (const Vec& v) const
+    V operator + (const V& v) const
     {
-        Vec<T, N> t(*this); t += v; return t;
+        V t(self()); t += v; return t;
     }
     // *** subtract vectot
-    Vec& operator -= (const Vec& v)
+    V& operator -= (const V& v)
     {
         return transform(v, std::minus<T>());
     }
-    Vec operator - (const Vec& v) const
+    V operator - (const V& v) const
     {
-        Vec<T, N> t(*this); t -= v; return t;
+        V t(self()); t -= v; return t;
     }
     // *** reverse
-    Vec operator - () const
+    V operator - () const
     {
         return (*this) * T(-1);
     }
     // *** dot product
-    T dot(const Vec& v) const
+    T dot(const V& v) const
     {
         return std::inner_product(this->begin(), this->end(), v.begin(), T(0));
     }
     // ***
     T magnitude() const
     {
-        return sqrt(dot(*this));
+        return sqrt(dot(self()));
     }
     // ***
     void normalize()
@@ -87,13 +92,297 @@ public:
         if (mag)
             *this *= 1 / mag;
     }
-    Vec normalized()
+    V normalized() const
+    {
+        V t(self());
+        t.normalize();
+        return t;
+    }
+    // approximate normalize, same as normalize() here
+    void normalize_fast()
+    {
+        normalize();
+    }
+
+private:
+    V&       self()       { return static_cast<V&>(*this); }
+    const V& self() const { return static_cast<const V&>(*this); }
+};
+
+template<typename T, std::size_t N>
+class Vec : public VecBase<Vec<T, N>, T, N>
+{
+public:
+    using VecBase<Vec<T, N>, T, N>::VecBase;
+    Vec() {}
+};
+
+#if defined(__SSE2__) && !defined(VECMAT_NO_SIMD)
+#define VECMAT_SIMD 1
+#include <immintrin.h>
+
+// SSE implementation of Vec<float, 3> and Vec<float, 4>, held in one
+// register; a 3-vector keeps 0 in its padding lane. Results are bit-
+// identical to the generic template: dot products add lanes in the same
+// order and normalize() divides by the exact square root.
+template <std::size_t N>
+class VecF
+{
+public:
+    typedef float        value_type;
+    typedef float*       iterator;
+    typedef const float* const_iterator;
+
+    VecF() : m_v(_mm_setzero_ps()) {}
+    template <typename U>
+    VecF(const Vec<U, N>& other) { load(other.begin()); }
+    VecF(const float& v) : m_v(N == 3 ? _mm_set_ps(0, v, v, v) : _mm_set1_ps(v)) {}
+    VecF(std::initializer_list<float> l) : m_v(set(l.begin())) {}
+    explicit VecF(__m128 v) : m_v(v) {}
+
+    iterator       begin()       { return reinterpret_cast<float*>(&m_v); }
+    const_iterator begin() const { return reinterpret_cast<const float*>(&m_v); }
+    iterator       end()         { return begin() + N; }
+    const_iterator end()   const { return begin() + N; }
+    float*         data()        { return begin(); }
+    const float*   data()  const { return begin(); }
+    static constexpr std::size_t size() { return N; }
+    float&         operator [] (std::size_t i)       { return begin()[i]; }
+    const float&   operator [] (std::size_t i) const { return begin()[i]; }
+    __m128         simd()  const { return m_v; }
+
+    template <typename OP>
+    Vec<float, N>& transform(OP op)
+    {
+        std::transform(begin(), end(), begin(), op);
+        return self();
+    }
+    template <typename OP, typename U>
+    Vec<float, N>& transform(const Vec<U, N>& u, OP op)
+    {
+        std::transform(begin(), end(), u.begin(), begin(), op);
+        return self();
+    }
+
+    // *** multiply scalar
+    Vec<float, N>& operator *= (const float& x)
+    {
+        m_v = _mm_mul_ps(m_v, _mm_set1_ps(x));
+        return self();
+    }
+    Vec<float, N> operator * (const float& x) const
+    {
+        return Vec<float, N>(_mm_mul_ps(m_v, _mm_set1_ps(x)));
+    }
+    // *** multiply vector
+    Vec<float, N>& operator *= (const VecF& v)
+    {
+        m_v = _mm_mul_ps(m_v, v.m_v);
+        return self();
+    }
+    Vec<float, N> operator * (const VecF& v) const
+    {
+        return Vec<float, N>(_mm_mul_ps(m_v, v.m_v));
+    }
+    // *** add vector
+    Vec<float, N>& operator += (const VecF& v)
+    {
+        m_v = _mm_add_ps(m_v, v.m_v);
+        return self();
+    }
+    Vec<float, N> operator + (const VecF& v) const
+    {
+        return Vec<float, N>(_mm_add_ps(m_v, v.m_v));
+    }
+    // *** subtract vector
+    Vec<float, N>& operator -= (const VecF& v)
+    {
+        m_v = _mm_sub_ps(m_v, v.m_v);
+        return self();
+    }
+    Vec<float, N> operator - (const VecF& v) const
+    {
+        return Vec<float, N>(_mm_sub_ps(m_v, v.m_v));
+    }
+    // *** reverse
+    Vec<float, N> operator - () const
+    {
+        return Vec<float, N>(_mm_mul_ps(m_v, _mm_set1_ps(-1)));
+    }
+    // *** dot product, summed in lane order like std::inner_product
+    float dot(const VecF& v) const
+    {
+        return _mm_cvtss_f32(dot_ss(m_v, v.m_v));
+    }
+    // ***
+    float magnitude() const
+    {
+        return _mm_cvtss_f32(_mm_sqrt_ss(dot_ss(m_v, m_v)));
+    }
+    // *** dot, square root and scale without leaving the register
+    void normalize()
+    {
+        __m128 mag = _mm_sqrt_ss(dot_ss(m_v, m_v));
+        if (_mm_cvtss_f32(mag))
+            m_v = _mm_mul_ps(m_v, broadcast(_mm_div_ss(_mm_set_ss(1), mag)));
+    }
+    Vec<float, N> normalized() const
+    {
+        Vec<float, N> t(m_v);
+        t.normalize();
+        return t;
+    }
+    // *** reciprocal square root estimate refined by one Newton step;
+    // about 22 bits of precision, not bit-identical to normalize()
+    void normalize_fast()
+    {
+        __m128 d = dot_ss(m_v, m_v);
+        if (!_mm_cvtss_f32(d))
+            return;
+        __m128 y = _mm_rsqrt_ss(d);
+        // y * (1.5 - 0.5 * d * y * y)
+        y = _mm_mul_ss(y, _mm_sub_ss(_mm_set_ss(1.5f),
+                                     _mm_mul_ss(_mm_mul_ss(_mm_set_ss(0.5f), d), _mm_mul_ss(y, y))));
+        m_v = _mm_mul_ps(m_v, broadcast(y));
+    }
+
+private:
+    template <typename It>
+    void load(It p)
+    {
+        alignas(16) float t[4] = {};
+        std::copy_n(p, N, t);
+        m_v = _mm_load_ps(t);
+    }
+    static __m128 set(const float* p)
+    {
+        return _mm_set_ps(N == 4 ? p[3] : 0, p[2], p[1], p[0]);
+    }
+    static __m128 broadcast(__m128 v)
+    {
+        return _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0));
+    }
+    static __m128 dot_ss(__m128 a, __m128 b)
+    {
+        __m128 m = _mm_mul_ps(a, b);
+        __m128 s = _mm_add_ss(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1)));
+        s = _mm_add_ss(s, _mm_movehl_ps(m, m));
+        if (N == 4)
+            s = _mm_add_ss(s, _mm_shuffle_ps(m, m, _MM_SHUFFLE(3, 3, 3, 3)));
+        return s;
+    }
+    Vec<float, N>&       self()       { return static_cast<Vec<float, N>&>(*this); }
+
+    __m128 m_v;
+};
+
+template <>
+class Vec<float, 3> : public VecF<3>
+{
+public:
+    using VecF<3>::VecF;
+    Vec() {}
+};
+
+template <>
+class Vec<float, 4> : public VecF<4>
+{
+public:
+    using VecF<4>::VecF;
+    Vec() {}
+};
+
+#ifdef __AVX__
+// AVX implementation of Vec<double, 3>, padded to four lanes. Storage is
+// not over-aligned, so it stays safe in containers without aligned new.
+template <>
+class Vec<double, 3>
+{
+public:
+    typedef double        value_type;
+    typedef double*       iterator;
+    typedef const double* const_iterator;
+
+    Vec() : m_a{0, 0, 0, 0} {}
+    template <typename U>
+    Vec(const Vec<U, 3>& other) : m_a{double(other[0]), double(other[1]), double(other[2]), 0} {}
+    Vec(const double& v) : m_a{v, v, v, 0} {}
+    Vec(std::initializer_list<double> l) : m_a{0, 0, 0, 0} { std::copy_n(l.begin(), 3, m_a); }
+    explicit Vec(__m256d v) { _mm256_storeu_pd(m_a, v); }
+    // copied whole: a copy written in halves and then read back as one
+    // register stalls on store forwarding
+    Vec(const Vec& v) { _mm256_storeu_pd(m_a, v.simd()); }
+    Vec& operator = (const Vec& v) { _mm256_storeu_pd(m_a, v.simd()); return *this; }
+
+    iterator       begin()       { return m_a; }
+    const_iterator begin() const { return m_a; }
+    iterator       end()         { return m_a + 3; }
+    const_iterator end()   const { return m_a + 3; }
+    double*        data()        { return m_a; }
+    const double*  data()  const { return m_a; }
+    static constexpr std::size_t size() { return 3; }
+    double&        operator [] (std::size_t i)       { return m_a[i]; }
+    const double&  operator [] (std::size_t i) const { return m_a[i]; }
+    __m256d        simd()  const { return _mm256_loadu_pd(m_a); }
+
+    template <typename OP>
+    Vec& transform(OP op)
+    {
+        std::transform(begin(), end(), begin(), op);
+        return *this;
+    }
+    template <typename OP, typename U>
+    Vec& transform(const Vec<U, 3>& u, OP op)
+    {
+        std::transform(begin(), end(), u.begin(), begin(), op);
+        return *this;
+    }
+
+    Vec& operator *= (const double& x) { return *this = *this * x; }
+    Vec  operator *  (const double& x) const { return Vec(_mm256_mul_pd(simd(), _mm256_set1_pd(x))); }
+    Vec& operator *= (const Vec& v)    { return *this = *this * v; }
+    Vec  operator *  (const Vec& v) const { return Vec(_mm256_mul_pd(simd(), v.simd())); }
+    Vec& operator += (const Vec& v)    { return *this = *this + v; }
+    Vec  operator +  (const Vec& v) const { return Vec(_mm256_add_pd(simd(), v.simd())); }
+    Vec& operator -= (const Vec& v)    { return *this = *this - v; }
+    Vec  operator -  (const Vec& v) const { return Vec(_mm256_sub_pd(simd(), v.simd())); }
+    Vec  operator -  () const          { return *this * -1.0; }
+
+    // *** dot product, summed in lane order like std::inner_product
+    double dot(const Vec& v) const
+    {
+        __m256d m  = _mm256_mul_pd(simd(), v.simd());
+        __m128d lo = _mm256_castpd256_pd128(m);
+        __m128d s  = _mm_add_sd(lo, _mm_unpackhi_pd(lo, lo));
+        return _mm_cvtsd_f64(_mm_add_sd(s, _mm256_extractf128_pd(m, 1)));
+    }
+    double magnitude() const
+    {
+        return std::sqrt(dot(*this));
+    }
+    void normalize()
+    {
+        double mag = magnitude();
+        if (mag)
+            *this *= 1 / mag;
+    }
+    Vec normalized() const
     {
         Vec t(*this);
         t.normalize();
         return t;
     }
+    void normalize_fast()
+    {
+        normalize();
+    }
+
+private:
+    double m_a[4];
 };
+#endif
+
+#endif
 
 template <typename T, std::size_t N>
 class Mat : public std::array<Vec<T, N>, N>
@@ -101,26 +390,34 @@ class Mat : public std::array<Vec<T, N>, N>
 public:
     Mat() = default;
     Mat(const Mat& other) = default;
+    Mat& operator = (const Mat& other) = default;
     Mat(std::initializer_list<T> l)
     {
         auto p = l.begin();
-        for (int i = 0; i < N; ++i)
-            for (int j = 0; j < N; ++j)
+        for (std::size_t i = 0; i < N; ++i)
+            for (std::size_t j = 0; j < N; ++j)
                 (*this)[i][j] = *p++;
     }
+    static Mat identity()
+    {
+        Mat m;
+        for (std::size_t i = 0; i < N; ++i)
+            m[i][i] = T(1);
+        return m;
+    }
     void transpose()
     {
-        for (int i = 1; i < (N - 1); ++i)
-            for (int j = i + 1; j < N; ++j)
+        for (std::size_t i = 0; i < N; ++i)
+            for (std::size_t j = i + 1; j < N; ++j)
                 std::swap((*this)[i][j], (*this)[j][i]);
     }    
     Mat& operator *= (Mat right)
     {
         right.transpose(); 
-        for(int i = 0; i < N; ++i)
+        for (std::size_t i = 0; i < N; ++i)
         {
             Vec<T, N> t = (*this)[i];
-            for(int j = 0; j < N; ++j)
+            for (std::size_t j = 0; j < N; ++j)
                 (*this)[i][j] = t.dot(right[j]);
         }
         return *this;
@@ -134,38 +431,158 @@ public:
 };
 
 // *** vector * matrix
-template<typename T, int N>
+template<typename T, std::size_t N>
 Vec<T, N> operator * (const Vec<T, N>& v, Mat<T, N> m)
 {
     Vec<T, N> t;
     m.transpose();
-    for(int i = 0; i < N; ++i)
+    for (std::size_t i = 0; i < N; ++i)
         t[i] = v.dot(m[i]);
     return t;
 }
 
-template<typename T, int N>
+template<typename T, std::size_t N>
 Vec<T, N>& operator *= (Vec<T, N>& v, const Mat<T, N>& m)
 {
     v = v * m;
     return v;
 }
 
-template<typename T, int N>
+// Affine transforms are 4x4 matrices acting on row vectors, p' = p * m,
+// with the translation in the last row; transforms chain left to right.
+template <typename T>
+Mat<T, 4> translation(const Vec<T, 3>& t)
+{
+    auto m = Mat<T, 4>::identity();
+    for (int i = 0; i < 3; ++i)
+        m[3][i] = t[i];
+    return m;
+}
+
+template <typename T>
+Mat<T, 4> scaling(T s)
+{
+    auto m = Mat<T, 4>::identity();
+    for (int i = 0; i < 3; ++i)
+        m[i][i] = s;
+    return m;
+}
+
+// rotation by angle radians around a unit axis
+template <typename T>
+Mat<T, 4> rotation(const Vec<T, 3>& axis, T angle)
+{
+    T c = std::cos(angle), s = std::sin(angle), k = 1 - c;
+    T x = axis[0], y = axis[1], z = axis[2];
+    return { x * x * k + c,     x * y * k + z * s, x * z * k - y * s, 0,
+             y * x * k - z * s, y * y * k + c,     y * z * k + x * s, 0,
+             z * x * k + y * s, z * y * k - x * s, z * z * k + c,     0,
+             0,                 0,                 0,                 1 };
+}
+
+// Point and direction through an affine transform. The sums are spelled
+// out in the order transform_rays() uses so both give the same bits.
+template <typename T>
+Vec<T, 3> transform_point(const Vec<T, 3>& p, const Mat<T, 4>& m)
+{
+    return { ((p[0] * m[0][0] + p[1] * m[1][0]) + p[2] * m[2][0]) + m[3][0],
+             ((p[0] * m[0][1] + p[1] * m[1][1]) + p[2] * m[2][1]) + m[3][1],
+             ((p[0] * m[0][2] + p[1] * m[1][2]) + p[2] * m[2][2]) + m[3][2] };
+}
+
+template <typename T>
+Vec<T, 3> transform_vector(const Vec<T, 3>& v, const Mat<T, 4>& m)
+{
+    return { (v[0] * m[0][0] + v[1] * m[1][0]) + v[2] * m[2][0],
+             (v[0] * m[0][1] + v[1] * m[1][1]) + v[2] * m[2][1],
+             (v[0] * m[0][2] + v[1] * m[1][2]) + v[2] * m[2][2] };
+}
+
+// inverse of an affine transform: the 3x3 part is inverted through its
+// cofactors, the translation then moved back through that inverse
+template <typename T>
+Mat<T, 4> affine_inverse(const Mat<T, 4>& m)
+{
+    Mat<T, 4> inv;
+    for (int i = 0; i < 3; ++i)
+        for (int j = 0; j < 3; ++j)
+        {
+            // cofactor of m[j][i] gives inv[i][j]
+            int r0 = (j + 1) % 3, r1 = (j + 2) % 3;
+            int c0 = (i + 1) % 3, c1 = (i + 2) % 3;
+            inv[i][j] = m[r0][c0] * m[r1][c1] - m[r0][c1] * m[r1][c0];
+        }
+    T det = m[0][0] * inv[0][0] + m[0][1] * inv[1][0] + m[0][2] * inv[2][0];
+    for (int i = 0; i < 3; ++i)
+        for (int j = 0; j < 3; ++j)
+            inv[i][j] /= det;
+    Vec<T, 3> t = transform_vector(Vec<T, 3>{ m[3][0], m[3][1], m[3][2] }, inv);
+    for (int i = 0; i < 3; ++i)
+        inv[3][i] = -t[i];
+    inv[3][3] = T(1);
+    return inv;
+}
+
+// Transform n rays held as arrays of origin and direction components, in
+// place; directions keep their length.
+template <typename T>
+void transform_rays(const Mat<T, 4>& m, T* ox, T* oy, T* oz, T* dx, T* dy, T* dz, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        auto o = transform_point(Vec<T, 3>{ ox[i], oy[i], oz[i] }, m);
+        auto d = transform_vector(Vec<T, 3>{ dx[i], dy[i], dz[i] }, m);
+        ox[i] = o[0]; oy[i] = o[1]; oz[i] = o[2];
+        dx[i] = d[0]; dy[i] = d[1]; dz[i] = d[2];
+    }
+}
+
+#ifdef VECMAT_SIMD
+// four rays at a time, one component per register
+inline void transform_rays(const Mat<float, 4>& m, float* ox, float* oy, float* oz,
+                           float* dx, float* dy, float* dz, std::size_t n)
+{
+    __m128 c[4][3];
+    for (int i = 0; i < 4; ++i)
+        for (int j = 0; j < 3; ++j)
+            c[i][j] = _mm_set1_ps(m[i][j]);
+    auto apply = [&] (float* x, float* y, float* z, bool point) {
+        __m128 vx = _mm_loadu_ps(x), vy = _mm_loadu_ps(y), vz = _mm_loadu_ps(z);
+        float* out[3] = { x, y, z };
+        for (int j = 0; j < 3; ++j)
+        {
+            __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, c[0][j]), _mm_mul_ps(vy, c[1][j])),
+                                  _mm_mul_ps(vz, c[2][j]));
+            if (point)
+                r = _mm_add_ps(r, c[3][j]);
+            _mm_storeu_ps(out[j], r);
+        }
+    };
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        apply(ox + i, oy + i, oz + i, true);
+        apply(dx + i, dy + i, dz + i, false);
+    }
+    transform_rays<float>(m, ox + i, oy + i, oz + i, dx + i, dy + i, dz + i, n - i);
+}
+#endif
+
+template<typename T, std::size_t N>
 std::ostream & operator << (std::ostream &os, const Vec<T, N>& v)
 {
     os << "[" << v[0];
-    for(int i = 1; i < N; ++i)
+    for (std::size_t i = 1; i < N; ++i)
         os << " " << v[i];
     os << "]";
     return os;
 }
 
-template<typename T, int N>
+template<typename T, std::size_t N>
 std::ostream & operator << (std::ostream &os, const Mat<T, N>& m)
 {
     os << "[" << m[0];
-    for(int i = 1; i < N; ++i)
+    for (std::size_t i = 1; i < N; ++i)
         os << "\n " << m[i];
     os << "]";
     return os;
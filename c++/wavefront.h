@@ -0,0 +1,198 @@
+#pragma once
+
+#include "trace.h"
+#include "packet.h"
+#include <vector>
+
+// Breadth first alternative to trace(). All primary rays of a tile are
+// intersected as one batch, their hits shaded, and the shadow rays and the
+// reflected and refracted rays that shading emits go to separate queues
+// that are again processed as whole batches, one bounce at a time. Every
+// ray keeps a link to the ray that spawned it; once the last bounce is
+// done the colors are gathered back up level by level in the order the
+// recursive integrator would have added them, so images are identical.
+template <typename T>
+class Wavefront
+{
+public:
+    // trace rays[i] into colors[i]; hits, if given, receives the
+    // primitive each ray hit or -1
+    void trace(const Scene<T>& scene, unsigned packet,
+               const std::vector<Ray<T>>& rays, std::vector<Vec3<T>>& colors,
+               std::vector<int>* hits = NULL)
+    {
+        m_depth = 0;
+        if (m_levels.empty())
+            m_levels.resize(1);
+        Level& primary = m_levels[0];
+        primary.clear();
+        for (unsigned i = 0; i < rays.size(); ++i)
+            primary.push_back(Entry(rays[i], 0, T(1), T(1), i, false));
+        STAT(primary += rays.size());
+
+        for (;;)
+        {
+            if (m_levels.size() < m_depth + 2)
+                m_levels.resize(m_depth + 2);
+            Level& queue = m_levels[m_depth];
+            Level& next  = m_levels[m_depth + 1];
+            next.clear();
+            STAT(depth[std::min(int(m_depth), int(RayStats::depths) - 1)] += queue.size());
+            intersect(scene, packet, queue);
+            if (hits && m_depth == 0)
+            {
+                hits->resize(queue.size());
+                for (unsigned i = 0; i < queue.size(); ++i)
+                    (*hits)[i] = queue[i].hit;
+            }
+            shade(scene, queue, next);
+            shadows(scene, queue);
+            if (next.empty())
+                break;
+            ++m_depth;
+        }
+
+        // gather secondary rays into the rays that spawned them
+        for (unsigned d = m_depth; d > 0; --d)
+        {
+            Level& parents = m_levels[d - 1];
+            for (auto& e: m_levels[d])
+                gather(parents[e.parent].frame, e.frame.result(), e.reflected);
+        }
+        colors.resize(rays.size());
+        for (auto& e: m_levels[0])
+            colors[e.parent] = e.frame.color;
+    }
+
+private:
+    struct Entry
+    {
+        TraceFrame<T> frame;
+        unsigned      parent;       // slot in the previous level, pixel for primary rays
+        bool          reflected;    // reflected rather than refracted ray
+        int           hit;
+        unsigned      part;         // of the primitive hit
+        T             nearest;
+
+        Entry(const Ray<T>& ray, int depth, T weight, T scale, unsigned parent, bool reflected)
+            : parent(parent), reflected(reflected)
+        {
+            frame.ray    = ray;
+            frame.depth  = depth;
+            frame.weight = weight;
+            frame.scale  = scale;
+            frame.color  = Vec3<T>(0);
+        }
+    };
+    typedef std::vector<Entry> Level;
+
+    struct Shadow
+    {
+        Ray<T>   ray;
+        T        distance;          // to the light
+        Vec3<T>  light;             // added to the target if not blocked
+        unsigned target;
+        unsigned index;             // of the light
+    };
+
+    // nearest hits of the whole queue, as packets where available
+    void intersect(const Scene<T>& scene, unsigned packet, Level& rays)
+    {
+        size_t i = 0;
+        switch (packet)
+        {
+        case 4:  i = intersect_packets<4>(scene, rays);  break;
+        case 8:  i = intersect_packets<8>(scene, rays);  break;
+        case 16: i = intersect_packets<16>(scene, rays); break;
+        }
+        for (; i < rays.size(); ++i)
+        {
+            rays[i].nearest = std::numeric_limits<T>::max();
+            rays[i].part    = 0;
+            rays[i].hit     = scene.intersect(rays[i].frame.ray, &rays[i].nearest, &rays[i].part);
+        }
+    }
+
+    // intersect whole packets of N rays; returns how many rays were done
+    template <unsigned N>
+    size_t intersect_packets(const Scene<T>& scene, Level& rays)
+    {
+        RayPacket<N> packet;
+        alignas(64) float nearest[N];
+        alignas(64) int   hit[N];
+        unsigned          part[N];
+        size_t i = 0;
+        for (; i + N <= rays.size(); i += N)
+        {
+            for (unsigned k = 0; k < N; ++k)
+            {
+                const Ray<T>& ray = rays[i + k].frame.ray;
+                packet.ox[k] = ray.start[0];
+                packet.oy[k] = ray.start[1];
+                packet.oz[k] = ray.start[2];
+                packet.dx[k] = ray.dir[0];
+                packet.dy[k] = ray.dir[1];
+                packet.dz[k] = ray.dir[2];
+                nearest[k]   = std::numeric_limits<float>::max();
+            }
+            if (!intersect_packet(scene, packet, nearest, hit, part))
+                break;
+            for (unsigned k = 0; k < N; ++k)
+            {
+                rays[i + k].hit     = hit[k];
+                rays[i + k].part    = part[k];
+                rays[i + k].nearest = T(nearest[k]);
+            }
+        }
+        return i;
+    }
+
+    // Surfaces of the hits; queue their shadow rays and the next bounce.
+    // Hits are shaded in ray order: sorting them by material to run one
+    // kernel per group costs more than it saves (see bench/shading).
+    void shade(const Scene<T>& scene, Level& rays, Level& next)
+    {
+        m_shadows.clear();
+        for (unsigned i = 0; i < rays.size(); ++i)
+        {
+            if (rays[i].hit < 0)
+                continue;
+            TraceFrame<T>& f = rays[i].frame;
+            surface(f, rays[i].hit, rays[i].part, rays[i].nearest, scene);
+
+            Vec3<T> diffuse_color = diffuse(*f.material, f.point);
+            unsigned index = 0;
+            for (auto& l: scene.lights)
+            {
+                Shadow s;
+                s.ray    = shadow_ray(f, *l, diffuse_color, &s.light, &s.distance);
+                s.target = i;
+                s.index  = index++;
+                m_shadows.push_back(s);
+            }
+
+            Ray<T> ray;
+            T      weight, scale;
+            while (secondary(f, scene, &ray, &weight, &scale))
+                next.push_back(Entry(ray, f.depth + 1, weight, scale, i,
+                                     f.next == TraceFrame<T>::REFRACT));
+        }
+    }
+
+    // direct light, in light order for every hit
+    void shadows(const Scene<T>& scene, Level& rays)
+    {
+        for (auto& s: m_shadows)
+        {
+            STAT(shadow++);
+            bool blocked = scene.occluded(s.ray, s.distance, last_occluder(s.index));
+            STAT(occluded += blocked);
+            if (!blocked)
+                rays[s.target].frame.color += s.light;
+        }
+    }
+
+    std::vector<Level>  m_levels;
+    std::vector<Shadow> m_shadows;
+    unsigned            m_depth;      // deepest level of the current trace
+};